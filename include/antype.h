@@ -305,7 +305,8 @@ namespace ante {
         AnDataType(std::string const& n, const std::vector<AnType*> elems, bool isUnion, AnModifier *m) :
                 AnAggregateType(isUnion ? TT_TaggedUnion : TT_Data, elems, m), name(n),
                 fields(), tags(), traitImpls(), unboundType(0), variants(), parentUnionType(0),
-                boundGenerics(), llvmType(0), isAlias(false){
+                boundGenerics(), llvmType(0), fieldIndices(), isAlias(false), isPacked(false),
+                keepFieldOrder(false), alignment(0){
 
             /* Just the type itself as DataTypes are considered opaque for type checking purposes
              * since only their names are checked.  If generics are added later to this type,
@@ -362,10 +363,25 @@ namespace ante {
          * May be nullptr if this type has not yet been translated. */
         llvm::Type* llvmType;
 
+        /** The index within llvmType of each field, in declaration order.
+         *  Empty if the fields were not reordered when translated. */
+        std::vector<unsigned> fieldIndices;
+
         /** True if this type is just an alias for its contents
          *  rather than an entirely new type */
         bool isAlias;
 
+        /** True if this type was declared ![packed] so its fields have no padding */
+        bool isPacked;
+
+        /** True if this type was declared ![extern] so its fields keep their declaration
+         *  order, eg. to match a C struct, rather than being reordered to minimize padding */
+        bool keepFieldOrder;
+
+        /** Minimum alignment in bytes set by ![align N] or ![cache_aligned], or 0 if
+         *  this type has its natural alignment */
+        unsigned alignment;
+
         /** Search for a data type by name.
          * Returns a stub type if no type with a matching name is found. */
         static AnDataType* get(std::string const& name, AnModifier *m = nullptr);
@@ -418,6 +434,20 @@ namespace ante {
             return -1;
         }
 
+        /** Returns the index within llvmType of the field at the given declaration index */
+        unsigned getLlvmFieldIndex(unsigned field) const {
+            return field < fieldIndices.size() ? fieldIndices[field] : field;
+        }
+
+        /** Copies the layout options and translated layout of dt */
+        void copyLayoutFrom(const AnDataType *dt){
+            llvmType = dt->llvmType;
+            fieldIndices = dt->fieldIndices;
+            isPacked = dt->isPacked;
+            keepFieldOrder = dt->keepFieldOrder;
+            alignment = dt->alignment;
+        }
+
         /** Returns true if this DataType's contents are not yet defined. */
         bool isStub() const {
             return extTys.empty();
@@ -17,7 +17,19 @@ namespace ante {
         Help,
         Lib,
         EmitLLVM,
-        NoColor
+        NoColor,
+        Jobs,
+        MArch,
+        MCpu,
+        MAttr,
+        Lto,
+        LtoThin,
+        Dynamic,
+        DumpLayout,
+        Remarks,
+        JitCache,
+        NoJitCache,
+        JitTierUp
     };
 
     struct Argument {
@@ -31,6 +43,9 @@ namespace ante {
         std::vector<std::unique_ptr<Argument>> args;
         std::vector<std::string> inputFiles;
 
+        /** @brief Arguments after --, passed on to the program run by -r */
+        std::vector<std::string> programArgs;
+
         void addArg(Argument *a);
         bool hasArg(Args a) const;
         Argument* getArg(Args a) const;
@@ -6,7 +6,12 @@
 namespace ante {
 
     /** A data structure for translating between c++ values
-     * and TypedValues while jitting. */
+     * and TypedValues while jitting.
+     *
+     * Values are laid out as the target DataLayout lays out their
+     * llvm type so they can be read and written by JIT-compiled code.
+     * Any memory allocated for the data, including the contents of
+     * constant pointers, is freed along with the last copy of the ArgTuple. */
     class ArgTuple {
 
         public:
@@ -17,7 +22,8 @@ namespace ante {
             void* asRawData() const { return data; }
 
             /**
-             * Constructs an ArgTuple from the given TypedValue arguments.
+             * Constructs an ArgTuple from the given TypedValue arguments,
+             * laid out as an unpacked llvm struct of each argument's type.
              *  - Assumes each Value* within each argument is a Constant*
              */
             ArgTuple(Compiler *c, std::vector<TypedValue> const& val);
@@ -28,7 +34,8 @@ namespace ante {
              */
             ArgTuple(Compiler *c, TypedValue const& val);
 
-            /** Constructs an ArgTuple using the given pre-initialized data. */
+            /** Constructs an ArgTuple using the given pre-initialized data.
+             *  The data is copied into constants and is not owned by the ArgTuple. */
             ArgTuple(Compiler *c, void *data, AnType *type);
 
             /** Constructs an empty ArgTuple representing a void literal. */
@@ -42,6 +49,12 @@ namespace ante {
             /** The type and value of this data. */
             TypedValue tval;
 
+            /** Memory allocated by this ArgTuple for data and the values it points to */
+            std::vector<std::shared_ptr<char>> buffers;
+
+            /** Returns size zeroed bytes owned by this ArgTuple */
+            void* allocate(size_t size);
+
             /** Stores pointer value of a constant pointer type */
             void storePtr(Compiler *c, TypedValue const& tv);
 
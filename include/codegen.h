@@ -0,0 +1,130 @@
+#ifndef AN_CODEGEN_H
+#define AN_CODEGEN_H
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "args.h"
+
+namespace ante {
+
+    /**
+     * @brief The cpu and cpu features native code is generated for.
+     *
+     * Shared by ahead of time compilation and the JIT.
+     */
+    struct TargetCpu {
+        /** @brief Name of the cpu, eg. "haswell".  Empty for the generic cpu of the native arch */
+        std::string name;
+
+        /** @brief Comma-separated features to enable or disable, eg. "+avx2,-sse4a" */
+        std::string features;
+
+        /** @brief Returns each feature in features as a separate string */
+        std::vector<std::string> featureList() const;
+    };
+
+    /** @brief The cpu selected with -march, -mcpu, and -mattr */
+    extern TargetCpu targetCpu;
+
+    /**
+     * @brief Sets targetCpu from the -march, -mcpu, and -mattr arguments.
+     *
+     * -march and -mcpu both select the cpu, with -mcpu taking priority if both
+     * are given.  A cpu of "native" selects the host cpu and all of its features.
+     * Any features given to -mattr are added after the cpu's features.
+     */
+    void selectTargetCpu(CompilerArgs *args);
+
+    /**
+     * @brief Directory the JIT caches the object code of compile-time functions in.
+     *
+     * Empty if the cache is disabled.
+     */
+    extern std::string jitCacheDir;
+
+    /**
+     * @brief Number of calls after which a function the JIT compiled without
+     * optimizations is recompiled with them.
+     *
+     * If 0, the default, every function is optimized before it is first run.
+     */
+    extern unsigned jitTierUpThreshold;
+
+    /**
+     * @brief Sets jitCacheDir and jitTierUpThreshold from the -jit-cache,
+     * -no-jit-cache, and -jit-tier-up arguments.
+     *
+     * The cache is only enabled by -jit-cache.  Nothing is ever evicted from
+     * it, so the directory is left for the user to clear.
+     */
+    void selectJitOptions(CompilerArgs *args);
+
+    /**
+     * @brief Creates a new TargetMachine for the given target and targetCpu.
+     *
+     * This does not initialize or lookup the target and is thus safe
+     * to call from multiple threads at once.
+     */
+    llvm::TargetMachine* createTargetMachine(const llvm::Target *target);
+
+    /**
+     * @brief Code generation state shared by every Compiler, JIT, and the REPL
+     * within the process.
+     *
+     * The native target is initialized and each TargetMachine created once,
+     * on first use.  targetCpu must be selected before the first call to get().
+     */
+    struct CodegenCtxt {
+        const llvm::Target *target;
+
+        /** @brief TargetMachine used for ahead of time compilation and optimization */
+        std::unique_ptr<llvm::TargetMachine> tm;
+
+        const llvm::DataLayout dl;
+
+        /** @brief Returns the shared CodegenCtxt, creating it on the first call */
+        static CodegenCtxt& get();
+
+        /**
+         * @brief Returns the TargetMachine used by each JIT, creating it on the first call.
+         *
+         * This is separate from tm as the JIT needs a relocation model suitable for
+         * loading code into the current process.
+         */
+        llvm::TargetMachine& getJitTargetMachine();
+
+        /** @brief Sets the target triple and data layout of mod to that of the native target */
+        void configureModule(llvm::Module *mod) const;
+
+        CodegenCtxt(CodegenCtxt const&) = delete;
+
+        private:
+            std::unique_ptr<llvm::TargetMachine> jitTm;
+
+            CodegenCtxt();
+    };
+
+    /**
+     * @brief Tags each function defined in mod with targetCpu and embeds targetCpu
+     * into the module's llvm.ident so it can later be read out of the object file.
+     */
+    void recordTargetCpu(llvm::Module *mod);
+
+    /** @brief Returns the llvm.ident entry recordTargetCpu embeds for the current targetCpu */
+    std::string getTargetCpuIdent();
+
+    /**
+     * @brief Returns false if mod was tagged by recordTargetCpu with a different
+     * cpu or features than the current targetCpu.  Modules without a tag match.
+     *
+     * Only .bc inputs are checked since they are the only precompiled inputs the
+     * compiler accepts.  Object files are not read back.
+     */
+    bool matchesTargetCpu(const llvm::Module *mod);
+}
+
+#endif
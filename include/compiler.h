@@ -4,6 +4,7 @@
 #include <climits> //required by llvm when using clang
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
@@ -185,12 +186,16 @@ namespace ante {
         Module *module;
         std::vector<std::pair<TypedValue,LOC_TY>> returns;
 
+        /** @brief The internal function lowerAggregateAbi moved the body of tv into,
+         * leaving tv an always-inline shim.  nullptr if the body was not moved. */
+        llvm::Function *impl;
+
         std::string& getName() const {
             return fdn->name;
         }
 
-        FuncDecl(std::shared_ptr<parser::FuncDeclNode> &fn, std::string &n, unsigned int s, Module *mod, TypedValue f) : fdn(fn), mangledName(n), scope(s), tv(f), type(0), module(mod), returns(){}
-        FuncDecl(std::shared_ptr<parser::FuncDeclNode> &fn, std::string &n, unsigned int s, Module *mod) : fdn(fn), mangledName(n), scope(s), tv(), type(0), module(mod), returns(){}
+        FuncDecl(std::shared_ptr<parser::FuncDeclNode> &fn, std::string &n, unsigned int s, Module *mod, TypedValue f) : fdn(fn), mangledName(n), scope(s), tv(f), type(0), module(mod), returns(), impl(nullptr){}
+        FuncDecl(std::shared_ptr<parser::FuncDeclNode> &fn, std::string &n, unsigned int s, Module *mod) : fdn(fn), mangledName(n), scope(s), tv(), type(0), module(mod), returns(), impl(nullptr){}
         ~FuncDecl(){}
     };
 
@@ -301,12 +306,34 @@ namespace ante {
          */
         llvm::StringMap<std::shared_ptr<Trait>> traits;
 
+        /**
+         * @brief The module this is a copy-on-write view of, or nullptr if it is not a view.
+         *
+         * Compilers created to run compile-time functions view their parent's declarations
+         * through this rather than copying all of them up front.  Types and traits are looked
+         * up through the parent while the function declarations of a name are copied into
+         * fnDecls when first used, as each records whether it was compiled in this module.
+         */
+        Module *parent = nullptr;
+
         /**
         * @brief Merges two modules
         *
         * @param m module to merge into this
         */
         void import(Module *m);
+
+        /**
+         * @brief Returns the declarations of each function with the given name,
+         * copying them out of the parent module first if needed.
+         */
+        std::vector<std::shared_ptr<FuncDecl>>& getFnDecls(llvm::StringRef name);
+
+        /** @brief Returns the data type with the given name or nullptr if it is not found */
+        AnDataType* getUserType(llvm::StringRef name) const;
+
+        /** @brief Returns the trait with the given name or nullptr if it is not found */
+        Trait* getTrait(llvm::StringRef name) const;
     };
 
     /**
@@ -343,17 +370,40 @@ namespace ante {
         /** @brief functions to run whenever a function is declared. */
         std::vector<std::shared_ptr<FuncDecl>> on_fn_decl_hook;
 
-        /** @brief arguments to current ante function being called.
-         * Will be empty if !isJIT */
+        /** @brief Functions declared since the on_fn_decl hooks were last run, each
+         * paired with the number of hooks registered before it was declared. */
+        std::vector<std::pair<std::shared_ptr<FuncDecl>, size_t>> pendingFnDecls;
+
+        /** @brief Set while a module's declarations are scanned so that the
+         * on_fn_decl hooks are run once for all of them afterward. */
+        bool batchFnDecls = false;
+
+        /** @brief arguments to current ante function being called.  Only
+         * type values are forwarded into its body.  Will be empty if !isJIT */
         std::vector<TypedValue> args;
     };
 
+    /**
+     * @brief Link-time optimization modes, selected with -flto and -flto-thin
+     */
+    enum class LtoMode {
+        /** @brief Modules are compiled to objects and optimized separately */
+        None,
+
+        /** @brief Bitcode of every module is merged and optimized as a whole */
+        Full,
+
+        /** @brief As Full, but only the definitions referenced by the program
+         * are merged in and the ThinLTO pipeline is used.  No module summary is
+         * written or used, so this is not distributed ThinLTO */
+        Thin
+    };
+
     /**
      * @brief An Ante compiler responsible for a single module
      */
     struct Compiler {
         std::shared_ptr<llvm::LLVMContext> ctxt;
-        std::unique_ptr<llvm::ExecutionEngine> jit;
         std::unique_ptr<llvm::Module> module;
         std::unique_ptr<parser::RootNode> ast;
         llvm::IRBuilder<> builder;
@@ -384,7 +434,30 @@ namespace ante {
 
         bool errFlag, compiled, isLib, isJIT;
         std::string fileName, outFile, funcPrefix;
-        unsigned int scope, optLvl, fnScope;
+        unsigned int scope, optLvl, sizeLvl, fnScope;
+
+        /** @brief Number of threads native code generation is split across.  Set with -j */
+        unsigned int jobs;
+
+        LtoMode lto;
+
+        /** @brief Bitcode files to merge into this module before optimizing when lto is set */
+        std::vector<std::string> ltoInputs;
+
+        /** @brief Link executables dynamically rather than statically.  Set with -dynamic */
+        bool dynamicLink;
+
+        /** @brief Print the memory layout of each type when it is first used.  Set with -dump-layout */
+        bool dumpLayouts;
+
+        /** @brief Report the optimizations applied to each function.  Set with -remarks */
+        bool remarks;
+
+        /** @brief The functions marked ![inline], checked after optimization to
+         * report those that could not be inlined.  Held by WeakVH as generic
+         * instantiations are renamed after being marked and the optimizer
+         * deletes those it inlined everywhere. */
+        std::vector<llvm::WeakVH> inlineFns;
 
         /**
         * @brief The main constructor for Compiler
@@ -415,7 +488,18 @@ namespace ante {
         void compileNative();
 
         /**
-        * @brief Compiles a module to an object file
+        * @brief Compiles the module with the JIT and calls its main function
+        * within this process, skipping the link and process creation of -r
+        *
+        * @param programArgs Arguments passed to main after the program name
+        *
+        * @return The exit code returned by main, or 1 if compilation failed
+        */
+        int  runJit(std::vector<std::string> const& programArgs);
+
+        /**
+        * @brief Compiles a module to an object file, or to a bitcode
+        * file if lto is set
         *
         * @param outName name of the file to output
         *
@@ -423,6 +507,24 @@ namespace ante {
         */
         int  compileObj(std::string &outName);
 
+        /**
+        * @brief Merges the bitcode of each file in ltoInputs into the module and
+        * internalizes every symbol other than main so that the whole program
+        * can be optimized at once.
+        *
+        * @return 0 on success
+        */
+        int  linkLtoInputs();
+
+        /**
+        * @brief Links in ltoInputs and optimizes the whole program at once if lto
+        * is set.  Only called when making an executable, never with -c, as the
+        * module's symbols are internalized.
+        *
+        * @return 0 on success
+        */
+        int  optimizeWholeProgram();
+
         /**
         * @brief Imports the prelude module unless the current module is the prelude
         */
@@ -459,8 +561,11 @@ namespace ante {
         *        the command line arguments
         *
         * @param args The command line arguments
+        *
+        * @return The exit code of the program run with -r, otherwise 0 unless
+        *         an argument is invalid
         */
-        void processArgs(CompilerArgs *args);
+        int processArgs(CompilerArgs *args);
 
         //binop functions
         /**
@@ -524,7 +629,10 @@ namespace ante {
         TypedValue compErr(lazy_printer msg, ErrorType t = ErrorType::Error);
 
         /**
-        * @brief JIT compiles a function with no arguments and calls it afterward
+        * @brief JIT compiles a function with no arguments and calls it afterward.
+        * The current module is moved into the shared JIT session, so a new one
+        * must be set before compiling anything else.  f is renamed to a name
+        * unique within the session.
         *
         * @param f the function to JIT
         */
@@ -613,6 +721,17 @@ namespace ante {
          */
         void registerFunction(parser::FuncDeclNode *func, std::string &mangledName);
 
+        /**
+         * @brief Runs the on_fn_decl hooks for every function declared since they last ran.
+         *
+         * Declarations are delivered in the order they were declared, and each is given
+         * to the hooks registered before it in the order they were registered.  Outside of
+         * scanAllDecls this happens as soon as each function is declared.  Within it, all
+         * declarations of the module are delivered together once it finishes, so hooks
+         * observe every function of a module before any of its code is compiled.
+         */
+        void runFnDeclHooks();
+
         /*
          * @brief Returns the current scope of the block compiling.
          */
@@ -756,6 +875,9 @@ namespace ante {
         /**
         * @brief Compiles a module into an obj file to be used for linking.
         *
+        * If jobs > 1 the module is split into that many partitions which
+        * are compiled in parallel and merged back into a single obj file.
+        *
         * @param mod The already-compiled module
         * @param outFile Name of the file to output
         *
@@ -765,16 +887,36 @@ namespace ante {
 
         TypedValue getVoidLiteral();
 
+        /**
+        * @brief Creates an alloca in the entry block of the current function
+        * regardless of the current insert point.
+        *
+        * Allocas outside the entry block are executed each time their block is,
+        * growing the stack within loops, and cannot be promoted by mem2reg.  All
+        * stack allocations should thus be made through this function.
+        *
+        * @param ty Type to allocate space for
+        * @param name Optional name of the alloca
+        */
+        llvm::AllocaInst* createEntryBlockAlloca(llvm::Type *ty, std::string const& name = "");
+
+        /**
+        * @brief Creates an uninitialized private global of the given type,
+        * aligned to the type's ![align N] if it has one
+        */
+        llvm::GlobalVariable* createGlobal(llvm::Type *ty, std::string const& name);
+
         /**
         * @brief Invokes the linker specified by AN_LINKER (in target.h) to
         *        link each object file
         *
         * @param inFiles String containing each obj file to link separated with spaces
         * @param outFile Name of the file to output
+        * @param dynamic Link against shared libraries rather than statically
         *
         * @return 0 on success
         */
-        static int linkObj(std::string inFiles, std::string outFile);
+        static int linkObj(std::string inFiles, std::string outFile, bool dynamic = false);
     };
 
     /**
@@ -795,6 +937,12 @@ namespace ante {
      */
     TypedValue addrOf(Compiler *c, TypedValue &tv);
 
+    /*
+     * @brief Creates a value of the given tagged union with the layout chosen by getUnionLayout.
+     * variant is the tag's associated data, or nullptr if it has none.
+     */
+    TypedValue createUnionValue(Compiler *c, AnDataType *unionTy, size_t tagVal, llvm::Value *variant);
+
 
     /**
     *  Compile a compile-time function/macro which should not return a function call, just a compile-time constant.
@@ -805,6 +953,26 @@ namespace ante {
     */
     TypedValue compMetaFunctionResult(Compiler *c, LOC_TY const& loc, std::string const& baseName, std::string const& mangledName, std::vector<TypedValue> const& typedArgs);
 
+    /**
+    *  Prints how many compile-time function calls needed a new function compiled
+    *  by the JIT and how many reused one compiled for an earlier call.
+    */
+    void reportMetaFunctionCache();
+
+    /**
+    *  Forgets each compiled compile-time function, on_fn_decl hook, and memoized
+    *  result.  They refer to the types and declarations of the current input so
+    *  this must be called before they are freed.
+    */
+    void clearMetaFunctionCache();
+
+    /**
+    *  Calls the on_fn_decl hook with the given declaration.  Each hook is compiled
+    *  into the JIT once, taking the address of its FuncDecl as a runtime argument,
+    *  and reused for every later declaration.
+    */
+    void callFnDeclHook(Compiler *c, FuncDecl *hook, FuncDecl *decl);
+
     /**
      *  Search for a given function specified by the expression l.
      *
@@ -883,6 +1051,9 @@ namespace ante {
 
     std::string removeFileExt(std::string file);
 
+    /** @brief Returns true if the given file name has a .bc extension */
+    bool isBitcodeFile(std::string const& file);
+
 }
 
 #endif
@@ -0,0 +1,27 @@
+#ifndef AN_ESCAPE_H
+#define AN_ESCAPE_H
+
+#include <llvm/IR/Function.h>
+
+namespace ante {
+
+    /** @brief Allocations larger than this many bytes are always left on the heap */
+    const uint64_t AN_MAX_STACK_PROMOTION = 4096;
+
+    /**
+     * @brief Replaces each constant sized malloc in f whose result never escapes
+     * the function with an alloca in f's entry block, and removes the calls to free
+     * on it.
+     *
+     * A pointer escapes if it is returned, passed to any function other than free,
+     * stored anywhere other than a local variable, or merged with another pointer.
+     * Pointers stored in local variables are followed through their loads, but only
+     * when the malloc is not within a loop as all iterations would then share the
+     * same stack slot.
+     *
+     * @return The number of allocations moved to the stack
+     */
+    unsigned promoteHeapAllocations(llvm::Function *f);
+}
+
+#endif
@@ -2,8 +2,11 @@
 #define AN_JIT_H
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
@@ -23,13 +26,63 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include "codegen.h"
 
 namespace ante {
-    
+
+    /**
+     * @brief Records that the integer constant addr, when found in a module given
+     * to the JIT, is the address of the compiler's own data, eg. the AnType of a
+     * type value, so DiskObjectCache never caches the module.
+     */
+    void markHostAddress(const void *addr);
+
+    /**
+     * @brief Caches the object code the JIT generates for each module on disk
+     * so later compilations can skip code generation for unchanged modules.
+     *
+     * Objects are keyed by a hash of the module's IR along with the target
+     * triple, cpu, features, and codegen optimization level of the TargetMachine
+     * compiling it.  The optimization tier of the IR itself is recorded in the
+     * module as a module flag and is thus included in the hash of the IR.
+     *
+     * Modules converting a constant to a pointer or containing an address given
+     * to markHostAddress refer to memory of the current compilation, which would
+     * be stale in the next one, and are never cached.
+     */
+    class DiskObjectCache : public llvm::ObjectCache {
+        private:
+            std::string dir;
+            const llvm::TargetMachine &tm;
+
+            /** @brief Module last missed in getObject and its path, so notifyObjectCompiled
+             * does not need to hash the module a second time. */
+            const llvm::Module *missedModule = nullptr;
+            std::string missedPath;
+
+            /** @brief Returns the path of the cached object for the given module,
+             * or "" if the module cannot be cached */
+            std::string getCachePath(const llvm::Module *m) const;
+
+        public:
+            size_t hits = 0;
+            size_t misses = 0;
+
+            DiskObjectCache(std::string dir, const llvm::TargetMachine &tm) : dir(dir), tm(tm){}
+
+            void notifyObjectCompiled(const llvm::Module *m, llvm::MemoryBufferRef obj) override;
+
+            std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *m) override;
+    };
+
     class JIT {
         private:
-            std::unique_ptr<llvm::TargetMachine> tm;
+            llvm::TargetMachine &tm;
             const llvm::DataLayout dl;
+
+            /** @brief nullptr if jitCacheDir is empty */
+            std::unique_ptr<DiskObjectCache> objCache;
+
             llvm::orc::RTDyldObjectLinkingLayer objectLayer;
             llvm::orc::IRCompileLayer<decltype(objectLayer), llvm::orc::SimpleCompiler> compileLayer;
 
@@ -39,47 +92,120 @@ namespace ante {
             llvm::orc::IRTransformLayer<decltype(compileLayer), OptimizeFunction> optimizeLayer;
 
             std::unique_ptr<llvm::orc::JITCompileCallbackManager> compileCallbackManager;
+
+            /** @brief Creates the stubs of each module added to codLayer, remembering
+             * the last one created in lastStubsManager so they can be updated on tier up */
+            std::function<std::unique_ptr<llvm::orc::IndirectStubsManager>()> createStubsManager;
+            llvm::orc::IndirectStubsManager *lastStubsManager = nullptr;
+
             llvm::orc::CompileOnDemandLayer<decltype(optimizeLayer)> codLayer;
 
             std::shared_ptr<llvm::Module> optimizeModule(std::shared_ptr<llvm::Module> m);
 
         public:
             using ModuleHandle = decltype(codLayer)::ModuleHandleT;
+            using EagerModuleHandle = decltype(compileLayer)::ModuleHandleT;
 
-            JIT() : tm(llvm::EngineBuilder().selectTarget()), dl(tm->createDataLayout()),
+            JIT() : tm(CodegenCtxt::get().getJitTargetMachine()), dl(tm.createDataLayout()),
+                    objCache(jitCacheDir.empty() ? nullptr : new DiskObjectCache(jitCacheDir, tm)),
                     objectLayer([](){ return std::make_shared<llvm::SectionMemoryManager>(); }),
-                    compileLayer(objectLayer, llvm::orc::SimpleCompiler(*tm)),
+                    compileLayer(objectLayer, llvm::orc::SimpleCompiler(tm, objCache.get())),
                     optimizeLayer(compileLayer, [this](std::shared_ptr<llvm::Module> m){
                                 return optimizeModule(std::move(m));
                     }),
                     compileCallbackManager(
-                            llvm::orc::createLocalCompileCallbackManager(tm->getTargetTriple(),
+                            llvm::orc::createLocalCompileCallbackManager(tm.getTargetTriple(),
                                 (llvm::JITTargetAddress)&handleUnrecognizedFn)),
+                    createStubsManager(llvm::orc::createLocalIndirectStubsManagerBuilder(tm.getTargetTriple())),
                     codLayer(optimizeLayer, [this](llvm::Function &f){
                                 //Appease the "'this' parameter not used" warning
                                 this->doNothing();
                                 return std::set<llvm::Function*>({&f});
                             },
                             *compileCallbackManager,
-                            llvm::orc::createLocalIndirectStubsManagerBuilder(tm->getTargetTriple())){
-                        
+                            [this](){
+                                auto stubs = createStubsManager();
+                                lastStubsManager = stubs.get();
+                                return stubs;
+                            }){
+
                         //pass a nullptr to load the current process
                         llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
                     }
 
             void doNothing() const {}
 
+            /** @brief Returns the JIT session shared by all code run at compile-time
+             * during this compilation, creating it on first use. */
+            static JIT& getSession();
+
             static void handleUnrecognizedFn();
 
-            llvm::TargetMachine& getTargetMachine() { return *tm; }
+            llvm::TargetMachine& getTargetMachine() { return tm; }
+
+            /** @brief Returns the on-disk object cache, or nullptr if it is disabled */
+            const DiskObjectCache* getObjectCache() const { return objCache.get(); }
 
             JIT::ModuleHandle addModule(std::unique_ptr<llvm::Module> m);
 
+            /**
+             * @brief Compiles the whole of m right away, without compiling its functions
+             * lazily or instrumenting them to tier up.
+             *
+             * m is expected to already be optimized at optLvl and is not optimized further.
+             */
+            JIT::EagerModuleHandle addModuleEagerly(std::unique_ptr<llvm::Module> m, unsigned optLvl);
+
+            /**
+             * @brief Returns a name for a function added to the session that is derived
+             * from key and is not yet used by any other.
+             *
+             * Code named by a key built from stable inputs gets the same name in each
+             * compilation, so the object cache can find the code again.
+             */
+            std::string getUniqueName(llvm::StringRef prefix, llvm::StringRef key);
+
             llvm::JITSymbol findSymbol(const std::string name);
 
             llvm::JITTargetAddress getSymbolAddress(const std::string name);
 
             void removeModule(JIT::ModuleHandle h);
+
+            /** @brief Number of functions recompiled with optimizations after
+             * being called jitTierUpThreshold times */
+            size_t tierUps = 0;
+
+            /**
+             * @brief Recompiles the given function with optimizations and points its stub
+             * to the optimized version so each later call runs it.
+             *
+             * Called by the unoptimized version of the function itself once it has been
+             * called jitTierUpThreshold times.  sourceId is the index in tierUpSources of
+             * the module the function is from, as function names are only unique within
+             * their module.  Calls already running are unaffected.
+             */
+            void tierUp(uint64_t sourceId, llvm::StringRef name);
+
+        private:
+            /** @brief An uninstrumented copy of a module added to the JIT and where it was added */
+            struct TierUpSource {
+                std::unique_ptr<llvm::Module> mod;
+                ModuleHandle handle;
+                llvm::orc::IndirectStubsManager *stubs;
+            };
+
+            /** @brief Each name given out by getUniqueName */
+            llvm::StringSet<> usedNames;
+
+            /** @brief Each module added while tiering is enabled, indexed by the id its
+             * code passes to tierUp.  Removed modules are left as nullptr. */
+            std::vector<std::shared_ptr<TierUpSource>> tierUpSources;
+
+            /** @brief Counts the calls to each function in m, calling tierUp with
+             * sourceId once jitTierUpThreshold is reached */
+            void addTierUpCounters(llvm::Module *m, uint64_t sourceId);
+
+            std::string mangle(llvm::StringRef name) const;
     };
 }
 
@@ -4,6 +4,8 @@
 #include "compiler.h"
 
 namespace ante {
+    std::unique_ptr<Compiler> createJitCompiler(Compiler *c, std::string const& modName);
+
     std::unique_ptr<Compiler> wrapFnInModule(Compiler *c, std::string const& basename,
             std::string const& mangledName, std::vector<TypedValue> const& args);
 }
@@ -0,0 +1,26 @@
+#ifndef AN_LINKER_H
+#define AN_LINKER_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <string>
+
+namespace ante {
+
+    /** @brief Returns true if ante was built with lld and can link executables in-process */
+    bool canLinkInProcess();
+
+    /**
+     * @brief Links the given in-memory object file into an executable using lld
+     * within the current process, without writing the object to disk.
+     *
+     * @param obj Contents of the object file to link
+     * @param outFile Name of the executable to output
+     * @param dynamic Link against shared libraries rather than statically
+     *
+     * @return 0 on success, 1 if linking failed, or -1 if in-process linking is
+     * unavailable and the caller should fall back to linking with AN_LINKER
+     */
+    int linkInProcess(llvm::ArrayRef<char> obj, std::string const& outFile, bool dynamic);
+}
+
+#endif
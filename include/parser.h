@@ -389,6 +389,9 @@ namespace ante {
             std::vector<std::unique_ptr<TypeNode>> generics;
             bool isAlias;
 
+            /** Modifiers and compiler directives (eg. ![packed]) preceding the declaration */
+            std::shared_ptr<ModNode> modifiers;
+
             void declare(Compiler*);
             void accept(NodeVisitor& v){ v.visit(this); }
             DataDeclNode(LOC_TY& loc, std::string s, Node* b, size_t f, bool a) : ParentNode(loc, b), name(s), fields(f), isAlias(a){}
@@ -65,7 +65,7 @@ namespace ante {
         Node* mkWhileNode(LOC_TY loc, Node* con, Node* body);
         Node* mkForNode(LOC_TY loc, Node* var, Node* range, Node* body);
         Node* mkFuncDeclNode(LOC_TY loc, Node* s, Node* mods, Node* tExpr, Node* p, Node* body);
-        Node* mkDataDeclNode(LOC_TY loc, char* s, Node *p, Node* b, bool isAlias);
+        Node* mkDataDeclNode(LOC_TY loc, char* s, Node *p, Node* b, bool isAlias, Node *mods = nullptr);
         Node* mkTraitNode(LOC_TY loc, char* s, Node* fns);
 
     }
@@ -17,6 +17,27 @@ namespace ante {
      * function or another valid insert point.
      */
     void startRepl(Compiler *c);
+
+    /**
+     * Records fd as declared by the current REPL input so later
+     * inputs may redefine it.  Does nothing outside of the REPL.
+     */
+    void replDeclaration(Compiler *c, FuncDecl *fd);
+
+    /**
+     * Records fd as compiled into the current REPL input's module so
+     * it is recompiled if that module is later removed.
+     */
+    void replCompiledFn(Compiler *c, FuncDecl *fd);
+
+    /**
+     * Removes fd, along with the compiled module it is in, when a
+     * REPL input redefines it.
+     *
+     * Returns false if no REPL is running or fd was not declared by
+     * a REPL input, in which case the redefinition is an error.
+     */
+    bool replRedefinition(Compiler *c, FuncDecl *fd);
 }
 
 #endif
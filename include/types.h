@@ -8,6 +8,16 @@
 #define AN_USZ_SIZE (8*sizeof(void*))
 #endif
 
+/* Alignment in bytes of types declared ![cache_aligned] */
+#ifndef AN_CACHE_LINE_SIZE
+#define AN_CACHE_LINE_SIZE 64
+#endif
+
+/* Alignment in bytes malloc guarantees, types aligned beyond this need aligned_alloc */
+#ifndef AN_MALLOC_ALIGNMENT
+#define AN_MALLOC_ALIGNMENT 16
+#endif
+
 namespace ante {
 
     TypedValue typeCheckWithImplicitCasts(Compiler *c, TypedValue &arg, AnType *ty);
@@ -30,6 +40,17 @@ namespace ante {
 
     llvm::Type* updateLlvmTypeBinding(Compiler *c, AnDataType *dt, bool force = false);
 
+    /** Returns the alignment set with ![align N] or ![cache_aligned] for the llvm type
+     *  of a data type, or of an array or tuple containing one, or 0 if the type has its
+     *  natural alignment */
+    unsigned getExplicitAlignment(llvm::Type *ty);
+
+    /** Returns the alignment of ty including any alignment set with ![align N] */
+    unsigned getAlignment(llvm::Type *ty);
+
+    /** Raises the alignment of gv to the explicit alignment of its type, if any */
+    void alignGlobal(llvm::GlobalVariable *gv);
+
     //conversions
     AnType* toAnType(Compiler *c, const parser::TypeNode *tn);
 
@@ -49,6 +70,38 @@ namespace ante {
     std::string getCastFnBaseName(AnType *t);
 
     AnType* getLargestExt(Compiler *c, AnDataType *tn, bool force = false);
+
+    /**
+     * The representation of a tagged union's values.
+     */
+    struct UnionLayout {
+        enum Kind {
+            /** A packed (tag, largest variant) pair */
+            Tagged,
+
+            /** Just the tag, used when no variant has any associated data */
+            Enum,
+
+            /** Just a pointer, used when the union's only other variant has no data
+             *  and its data is a pointer that can never be null, which currently
+             *  means a function.  The data-less variant is represented by null.
+             *  Raw pointers such as the data of Maybe 't* may be null and keep
+             *  the Tagged layout. */
+            NullNiche
+        } kind;
+
+        /** Width of the tag, the smallest whole number of bytes fitting every variant */
+        unsigned tagBits;
+
+        /** Tag of the data-less variant stored as null in a NullNiche layout */
+        size_t nicheTag;
+
+        size_t sizeInBits;
+    };
+
+    UnionLayout getUnionLayout(Compiler *c, AnDataType *dt, bool force = false);
+    unsigned getUnionTagBits(size_t numTags);
+    AnType* getUnionVariantData(AnType *variant);
     char getBitWidthOfTypeTag(const TypeTag tagTy);
     bool isPrimitiveTypeTag(TypeTag ty);
     bool isNumericTypeTag(const TypeTag ty);
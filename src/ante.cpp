@@ -7,6 +7,7 @@
 #include "yyparser.h"
 #include "args.h"
 #include "target.h"
+#include "codegen.h"
 #include <cstring>
 #include <iostream>
 #include <llvm/Support/TargetRegistry.h>
@@ -52,11 +53,23 @@ void printHelp(){
     puts("\t-c\t\tcompile to object file");
     puts("\t-o <filename>\tspecify output name");
     puts("\t-p\t\tprint parse tree");
-    puts("\t-O <number>\tSet optimization level. Arg of 0 = none, 3 = all");
-    puts("\t-r\t\tcompile and run");
+    puts("\t-O <level>\tSet optimization level. Arg of 0 = none, 3 = all, s/z = optimize for size");
+    puts("\t-j <number>\tSplit native code generation across the given number of threads");
+    puts("\t-march <cpu>\tGenerate code for the given cpu, or the host cpu if 'native'");
+    puts("\t-mcpu <cpu>\tSame as -march");
+    puts("\t-mattr <attrs>\tEnable (+attr) or disable (-attr) the given comma-separated cpu features");
+    puts("\t-r\t\tcompile and run in memory, or link and run the executable named by -o.  Arguments after -- are passed to the program");
     puts("\t-help\t\tprint this message");
     puts("\t-lib\t\tcompile as library (include all functions in binary and compile to object file)");
     puts("\t-emit-llvm\tprint llvm-IR as output");
+    puts("\t-flto\t\tEmit bitcode with -c and optimize the whole program at once when given .bc inputs");
+    puts("\t-flto-thin\tAs -flto, but only link in the definitions the program uses");
+    puts("\t-dynamic\tLink against shared libraries for faster links and smaller binaries");
+    puts("\t-dump-layout\tPrint the memory layout of each type used and the bytes saved by layout optimizations");
+    puts("\t-remarks\tReport the optimizations applied to each function and, with -flto, the generic instantiations folded between .bc inputs");
+    puts("\t-jit-cache <dir>\tCache the native code of compile-time functions in the given directory");
+    puts("\t-no-jit-cache\tAlways recompile compile-time functions, even if -jit-cache is given");
+    puts("\t-jit-tier-up <calls>\tRun compile-time functions unoptimized until they are called this many times.  By default they are optimized before they first run");
     puts("\t-check\t\tCheck program for errors without compiling");
     puts("\t-no-color\tprint uncolored output");
 
@@ -82,28 +95,39 @@ int main(int argc, const char **argv){
     init_compapi();
 
     auto *args = parseArgs(argc, argv);
+    int exitCode = 0;
     if(args->hasArg(Args::Help)) printHelp();
     if(args->hasArg(Args::NoColor)) colored_output = false;
+    selectTargetCpu(args);
+    selectJitOptions(args);
 
     for(auto input : args->inputFiles){
+        //bitcode files are linked into each compiled module instead
+        if(isBitcodeFile(input)) continue;
+
         Compiler ante{input.c_str()};
         if(args->hasArg(Args::Parse)){
             parser::printBlock(ante.ast.get());
         }
 
-        ante.processArgs(args);
+        if(int res = ante.processArgs(args))
+            exitCode = res;
+        clearMetaFunctionCache();
         typeArena.clearDeclaredTypes();
         allCompiledModules.clear();
         allMergedCompUnits.clear();
     }
 
-    if(args->hasArg(Args::Eval) or (args->args.empty() and args->inputFiles.empty()))
-        Compiler(0).eval();
+    if(args->hasArg(Args::Eval) or (args->args.empty() and args->inputFiles.empty())){
+        Compiler repl(0);
+        repl.remarks = args->hasArg(Args::Remarks);
+        repl.eval();
+    }
 
     if(yylexer)
         delete yylexer;
     delete args;
 
-    return 0;
+    return exitCode;
 }
 #endif
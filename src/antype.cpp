@@ -405,7 +405,7 @@ namespace ante {
         ret->unboundType = dt->unboundType;
         ret->boundGenerics = dt->boundGenerics;
         ret->generics = dt->generics;
-        ret->llvmType = dt->llvmType;
+        ret->copyLayoutFrom(dt);
         return ret;
     }
 
@@ -605,6 +605,9 @@ namespace ante {
         variant->extTys = boundExts;
         variant->tags = unboundType->tags;
         variant->traitImpls = unboundType->traitImpls;
+        variant->isPacked = unboundType->isPacked;
+        variant->keepFieldOrder = unboundType->keepFieldOrder;
+        variant->alignment = unboundType->alignment;
         updateLlvmTypeBinding(c, variant, variant->isGeneric);
         return variant;
     }
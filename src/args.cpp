@@ -16,7 +16,19 @@ map<string, Args> argsMap = {
     {"-help",      Args::Help},
     {"-lib",       Args::Lib},
     {"-emit-llvm", Args::EmitLLVM},
-    {"-no-color",  Args::NoColor}
+    {"-no-color",  Args::NoColor},
+    {"-j",         Args::Jobs},
+    {"-march",     Args::MArch},
+    {"-mcpu",      Args::MCpu},
+    {"-mattr",     Args::MAttr},
+    {"-flto",      Args::Lto},
+    {"-flto-thin", Args::LtoThin},
+    {"-dynamic",   Args::Dynamic},
+    {"-dump-layout", Args::DumpLayout},
+    {"-remarks",   Args::Remarks},
+    {"-jit-cache", Args::JitCache},
+    {"-no-jit-cache", Args::NoJitCache},
+    {"-jit-tier-up", Args::JitTierUp}
 };
 
 void CompilerArgs::addArg(Argument *a){
@@ -48,10 +60,10 @@ bool CompilerArgs::empty() const{
 enum ArgTy { None, Str, Int };
 
 ArgTy requiresArg(Args a){
-    if(a == OutputName)
+    if(a == OutputName or a == MArch or a == MCpu or a == MAttr or a == JitCache)
         return ArgTy::Str;
 
-    if(a == OptLvl)
+    if(a == OptLvl or a == Jobs or a == JitTierUp)
         return ArgTy::Int;
 
     return ArgTy::None;
@@ -68,7 +80,10 @@ CompilerArgs* ante::parseArgs(int argc, const char** argv){
     CompilerArgs* ret = new CompilerArgs();
 
     for(int i = 1; i < argc; i++){
-        if(argv[i][0] == '-'){
+        if(string(argv[i]) == "--"){
+            ret->programArgs.assign(argv + i + 1, argv + argc);
+            break;
+        }else if(argv[i][0] == '-'){
             try{
                 Args a = argsMap.at(argv[i]);
                 string s = "";
@@ -1,5 +1,7 @@
 #include "argtuple.h"
 #include "types.h"
+#include "codegen.h"
+#include <cstring>
 
 using namespace std;
 using namespace llvm;
@@ -24,6 +26,22 @@ namespace ante {
 
     TypedValue convertToTypedValue(Compiler *c, ArgTuple &arg, AnType *tn);
 
+    /**
+     * Returns the offset in bytes of the given field of tn within
+     * memory, as laid out by the target DataLayout.
+     */
+    uint64_t getFieldOffset(Compiler *c, AnAggregateType *tn, unsigned field){
+        auto *structTy = cast<StructType>(c->anTypeToLlvmType(tn));
+        auto *dataTy = dyn_cast<AnDataType>(tn);
+        unsigned index = dataTy ? dataTy->getLlvmFieldIndex(field) : field;
+        return CodegenCtxt::get().dl.getStructLayout(structTy)->getElementOffset(index);
+    }
+
+    /** Returns the number of bytes a value of the given llvm type occupies in memory */
+    size_t getAllocSize(Type *ty){
+        return ty->isSized() ? CodegenCtxt::get().dl.getTypeAllocSize(ty) : 0;
+    }
+
     TypedValue convertTupleToTypedValue(Compiler *c, ArgTuple &arg, AnAggregateType *tn){
         if(tn->extTys.empty()){
             return c->getVoidLiteral();
@@ -39,10 +57,9 @@ namespace ante {
         anElemTys.reserve(tn->extTys.size());
 
         map<unsigned, Value*> nonConstants;
-        size_t offset = 0;
 
         for(unsigned i = 0; i < tn->extTys.size(); i++){
-            char* elem = (char*)arg.asRawData() + offset;
+            char* elem = (char*)arg.asRawData() + getFieldOffset(c, tn, i);
             ArgTuple elemTup{c, (void*)elem, tn->extTys[i]};
             TypedValue tval = elemTup.asTypedValue();
 
@@ -53,24 +70,33 @@ namespace ante {
                 elems.push_back(UndefValue::get(tval.getType()));
             }
 
-            auto res = tn->extTys[i]->getSizeInBits(c);
-            if(!res){
-                c->errFlag = true;
-                cout << "Unknown/Unimplemented TypeTag " + typeTagToStr(tn->typeTag) << endl;
-                throw new CompilationError("Unknown/Unimplemented TypeTag " + typeTagToStr(tn->typeTag));
-            }
-
-            offset += res.getVal() / 8;
             elemTys.push_back(tval.getType());
             anElemTys.push_back(tval.type);
         }
 
+        //The fields of a data type may be reordered from their declaration order
+        auto *structTy = (StructType*)c->anTypeToLlvmType(tn);
+        auto *dataTy = dyn_cast<AnDataType>(tn);
+        if(dataTy and !dataTy->fieldIndices.empty()){
+            vector<Constant*> reordered(structTy->getNumElements(), nullptr);
+            for(unsigned i = 0; i < elems.size(); i++)
+                reordered[dataTy->getLlvmFieldIndex(i)] = elems[i];
+            elems = reordered;
+        }
+
+        //fill in the padding of an aligned type or of its over-aligned fields
+        elems.resize(structTy->getNumElements(), nullptr);
+        for(unsigned i = 0; i < elems.size(); i++)
+            if(!elems[i])
+                elems[i] = UndefValue::get(structTy->getElementType(i));
+
         //Create the constant tuple with undef values in place for the non-constant values
-        Value* tuple = ConstantStruct::get((StructType*)c->anTypeToLlvmType(tn), elems);
+        Value* tuple = ConstantStruct::get(structTy, elems);
 
         //Insert each pathogen value into the tuple individually
         for(const auto &p : nonConstants){
-            tuple = c->builder.CreateInsertValue(tuple, p.second, p.first);
+            unsigned index = dataTy ? dataTy->getLlvmFieldIndex(p.first) : p.first;
+            tuple = c->builder.CreateInsertValue(tuple, p.second, index);
         }
 
         return TypedValue(tuple, tn);
@@ -155,13 +181,15 @@ namespace ante {
         throw new CompilationError("Unknown/Unimplemented TypeTag " + typeTagToStr(tn->typeTag));
     }
 
+    void* ArgTuple::allocate(size_t size){
+        //operator new[] aligns to at least alignof(max_align_t), enough for any field
+        buffers.emplace_back(new char[size ? size : 1](), std::default_delete<char[]>());
+        return buffers.back().get();
+    }
+
+
     void ArgTuple::allocAndStoreValue(Compiler *c, TypedValue const& tv){
-        auto size = tv.type->getSizeInBits(c);
-        if(!size){
-            c->errFlag = true;
-            throw new CompilationError(size.getErr());
-        }
-        data = malloc(size.getVal() / 8);
+        data = allocate(getAllocSize(tv.getType()));
         storeValue(c, tv);
     }
 
@@ -175,8 +203,11 @@ namespace ante {
         if(GlobalVariable *gv = dyn_cast<GlobalVariable>(tv.val)){
             Value *v = gv->getInitializer();
             if(ConstantDataArray *cda = dyn_cast<ConstantDataArray>(v)){
-                char *cstr = strdup(cda->getAsString().str().c_str());
-                *(void**)data = cstr;
+                StringRef str = cda->getAsString();
+                void **ptr = (void**)data;
+                char *cstr = (char*)allocate(str.size() + 1);
+                memcpy(cstr, str.data(), str.size());
+                *ptr = cstr;
             }else{
                 TypedValue tv = {v, ptrty->extTy};
                 void **oldData = (void**)data;
@@ -243,21 +274,17 @@ namespace ante {
 
     void ArgTuple::storeTuple(Compiler *c, TypedValue const& tup){
         auto *sty = (AnAggregateType*)tup.type;
+        auto *dataTy = dyn_cast<AnDataType>(sty);
         if(ConstantStruct *ca = dyn_cast<ConstantStruct>(tup.val)){
             void *orig_data = this->data;
-            for(size_t i = 0; i < ca->getNumOperands(); i++){
-                Value *elem = ca->getAggregateElement(i);
+            for(size_t i = 0; i < sty->extTys.size() and i < ca->getNumOperands(); i++){
+                //the fields of a data type may be reordered from their declaration order
+                Value *elem = ca->getAggregateElement(dataTy ? dataTy->getLlvmFieldIndex(i) : i);
                 AnType *ty = sty->extTys[i];
                 auto field = TypedValue(elem, ty);
-                storeValue(c, field);
 
-                auto size = ty->getSizeInBits(c);
-                if(!size){
-                    c->errFlag = true;
-                    cout << "storeTuple: " << size.getErr() << endl;
-                    throw new CompilationError(size.getErr());
-                }
-                data = (char*)data + size.getVal() / 8;
+                data = (char*)orig_data + getFieldOffset(c, sty, i);
+                storeValue(c, field);
             }
             data = orig_data;
         }else{
@@ -312,7 +339,7 @@ namespace ante {
         }
 
         switch(tv.type->typeTag){
-            case TT_F16: *(float*)   data = cf->getValueAPF().convertToFloat(); return;
+            case TT_F16: *(uint16_t*)data = cf->getValueAPF().bitcastToAPInt().getZExtValue(); return;
             case TT_F32: *(float*)   data = cf->getValueAPF().convertToFloat(); return;
             case TT_F64: *(double*)  data = cf->getValueAPF().convertToDouble(); return;
             default: return;
@@ -373,33 +400,25 @@ namespace ante {
     ArgTuple::ArgTuple(Compiler *c, vector<TypedValue> const& tvals)
             : data(nullptr){
 
-        size_t size = 0;
-        for(auto &tv : tvals){
-            auto elemSize = tv.type->getSizeInBits(c);
-            if(!elemSize){
-                // NOTE: throwing exceptions in constructors is bad and can lead
-                //       to memory leaks or worse.
-                c->errFlag = true;
-                cout << "ArgTuple: sizeerror: " << elemSize.getErr() << '\n';
-                throw new CompilationError(elemSize.getErr());
-            }
+        vector<Type*> tys;
+        for(auto &tv : tvals)
+            tys.push_back(tv.getType());
 
-            elemSize = elemSize.getVal() / 8;
+        auto *tupleTy = StructType::get(*c->ctxt, tys);
+        auto *layout = CodegenCtxt::get().dl.getStructLayout(tupleTy);
+        void *tuple = allocate(layout->getSizeInBytes());
 
-            //we're reallocating the data manually here for the tuple
-            //so storeValue must be used instead of allocAndStore
-            void *dataBegin = realloc(data, size + elemSize.getVal());
-            data = (char*)dataBegin + size;
+        for(unsigned i = 0; i < tvals.size(); i++){
+            auto &tv = tvals[i];
+            data = (char*)tuple + layout->getElementOffset(i);
 
             if(tv.type->hasModifier(Tok_Mut)){
                 storeValue(c, findLastStore(c, tv));
             }else{
                 storeValue(c, tv);
             }
-
-            data = dataBegin;
-            size += elemSize.getVal();
         }
+        data = tuple;
     }
 
 
@@ -0,0 +1,207 @@
+#include "codegen.h"
+#include "target.h"
+
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm-c/Target.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+#if LLVM_VERSION_MAJOR >= 6
+#include <llvm/Support/raw_os_ostream.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace llvm;
+
+namespace ante {
+
+TargetCpu targetCpu;
+string jitCacheDir;
+unsigned jitTierUpThreshold = 0;
+
+vector<string> TargetCpu::featureList() const{
+    vector<string> ret;
+    SmallVector<StringRef, 16> split;
+    StringRef(features).split(split, ',', -1, false);
+
+    for(auto &f : split)
+        ret.push_back(f.str());
+
+    return ret;
+}
+
+
+/**
+ * @brief Returns every feature of the host cpu as a feature string
+ */
+string getHostFeatures(){
+    StringMap<bool> hostFeatures;
+    if(!sys::getHostCPUFeatures(hostFeatures))
+        return "";
+
+    //sort the features so the same host always produces the same string
+    vector<string> features;
+    for(auto &pair : hostFeatures)
+        features.push_back((pair.second ? "+" : "-") + pair.first().str());
+
+    std::sort(features.begin(), features.end());
+
+    string ret = "";
+    for(auto &f : features)
+        ret += ret.empty() ? f : "," + f;
+    return ret;
+}
+
+
+void selectTargetCpu(CompilerArgs *args){
+    Argument *cpu = args->getArg(Args::MCpu);
+    if(!cpu) cpu = args->getArg(Args::MArch);
+
+    if(cpu){
+        if(cpu->arg == "native"){
+            targetCpu.name = sys::getHostCPUName().str();
+            targetCpu.features = getHostFeatures();
+        }else{
+            targetCpu.name = cpu->arg;
+        }
+    }
+
+    if(auto *attrs = args->getArg(Args::MAttr)){
+        if(targetCpu.features.empty())
+            targetCpu.features = attrs->arg;
+        else
+            targetCpu.features += "," + attrs->arg;
+    }
+}
+
+
+void selectJitOptions(CompilerArgs *args){
+    if(args->hasArg(Args::NoJitCache))
+        jitCacheDir = "";
+    else if(auto *dir = args->getArg(Args::JitCache))
+        jitCacheDir = dir->arg;
+
+    if(auto *calls = args->getArg(Args::JitTierUp))
+        jitTierUpThreshold = atoi(calls->arg.c_str());
+}
+
+
+/** @brief Initializes and returns the native target */
+const Target* getTarget(){
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+    string err = "";
+
+    string triple = Triple(AN_NATIVE_ARCH, AN_NATIVE_VENDOR, AN_NATIVE_OS).getTriple();
+    const Target* target = TargetRegistry::lookupTarget(triple, err);
+
+    if(!err.empty()){
+        cerr << err << endl;
+		cerr << "Selected triple: " << AN_NATIVE_ARCH ", " AN_NATIVE_VENDOR ", " AN_NATIVE_OS << endl;
+		cout << "\nRegistered targets:" << endl;
+#if LLVM_VERSION_MAJOR >= 6
+        llvm::raw_os_ostream os{std::cout};
+		TargetRegistry::printRegisteredTargetsForVersion(os);
+#else
+		TargetRegistry::printRegisteredTargetsForVersion();
+#endif
+        exit(1);
+    }
+
+    return target;
+}
+
+
+TargetMachine* createTargetMachine(const Target *target){
+    string triple = Triple(AN_NATIVE_ARCH, AN_NATIVE_VENDOR, AN_NATIVE_OS).getTriple();
+    TargetOptions op;
+
+#if LLVM_VERSION_MAJOR >= 6
+    TargetMachine *tm = target->createTargetMachine(triple, targetCpu.name, targetCpu.features, op,
+            Reloc::Model::Static, None, CodeGenOpt::Level::Aggressive);
+#else
+    TargetMachine *tm = target->createTargetMachine(triple, targetCpu.name, targetCpu.features, op,
+            Reloc::Model::Static, CodeModel::Default, CodeGenOpt::Level::Aggressive);
+#endif
+
+    if(!tm){
+        cerr << "Error when initializing TargetMachine for cpu '" << targetCpu.name << "'.\n";
+        exit(1);
+    }
+
+    return tm;
+}
+
+
+CodegenCtxt::CodegenCtxt() : target(getTarget()), tm(createTargetMachine(target)),
+        dl(tm->createDataLayout()), jitTm(){}
+
+
+CodegenCtxt& CodegenCtxt::get(){
+    static CodegenCtxt ctxt;
+    return ctxt;
+}
+
+
+TargetMachine& CodegenCtxt::getJitTargetMachine(){
+    if(!jitTm){
+        jitTm.reset(EngineBuilder().setMCPU(targetCpu.name)
+                .setMAttrs(targetCpu.featureList()).selectTarget());
+    }
+    return *jitTm;
+}
+
+
+void CodegenCtxt::configureModule(llvm::Module *mod) const{
+    mod->setTargetTriple(tm->getTargetTriple().str());
+    mod->setDataLayout(dl);
+}
+
+
+void recordTargetCpu(llvm::Module *mod){
+    for(auto &f : *mod){
+        if(f.isDeclaration()) continue;
+
+        if(!targetCpu.name.empty())
+            f.addFnAttr("target-cpu", targetCpu.name);
+        if(!targetCpu.features.empty())
+            f.addFnAttr("target-features", targetCpu.features);
+    }
+
+    //llvm.ident is emitted into the .comment section of the object file
+    auto &ctxt = mod->getContext();
+    auto *identMd = mod->getOrInsertNamedMetadata("llvm.ident");
+    identMd->addOperand(MDNode::get(ctxt, MDString::get(ctxt, getTargetCpuIdent())));
+}
+
+
+string getTargetCpuIdent(){
+    string cpu = targetCpu.name.empty() ? "generic" : targetCpu.name;
+    return "ante target-cpu=" + cpu + " target-features=" + targetCpu.features;
+}
+
+
+bool matchesTargetCpu(const llvm::Module *mod){
+    auto *identMd = mod->getNamedMetadata("llvm.ident");
+    if(!identMd) return true;
+
+    string ident = getTargetCpuIdent();
+    for(auto *node : identMd->operands()){
+        if(node->getNumOperands() == 0) continue;
+
+        auto *str = dyn_cast<MDString>(node->getOperand(0));
+        if(str and str->getString().startswith("ante target-cpu=") and str->getString() != ident)
+            return false;
+    }
+    return true;
+}
+
+}
@@ -2,6 +2,8 @@
 #include "types.h"
 #include "jitlinker.h"
 #include "argtuple.h"
+#include "codegen.h"
+#include <llvm/Support/DynamicLibrary.h>
 
 using namespace std;
 using namespace llvm;
@@ -30,45 +32,88 @@ extern "C" {
     }
 
     void* Ante_error(Compiler *c, TypedValue &msgTv){
-        char *msg = *(char**)ArgTuple(c, msgTv).asRawData();
+        ArgTuple msgArg{c, msgTv};
+        char *msg = *(char**)msgArg.asRawData();
         auto *curfn = c->compCtxt->callStack.back()->fdn.get();
         yy::location fakeloc = mkLoc(mkPos(0,0,0), mkPos(0,0,0));
         c->compErr(msg, curfn ? curfn->loc : fakeloc);
         return nullptr;
     }
 
+    /** Called by the code FuncDecl_getName emits as on_fn_decl hooks
+     * are only given the address of their FuncDecl when they are run */
+    const char* ante_FuncDecl_getName(FuncDecl *fd){
+        return fd->getName().c_str();
+    }
+
     TypedValue* FuncDecl_getName(Compiler *c, TypedValue &fd){
-        FuncDecl *f = (FuncDecl*)((ConstantInt*)fd.val)->getZExtValue();
-        string &n = f->getName();
+        auto *voidPtrTy = c->builder.getInt8PtrTy();
+        auto *getNameTy = FunctionType::get(voidPtrTy, {voidPtrTy}, false);
+        auto getName = c->module->getOrInsertFunction("ante_FuncDecl_getName", getNameTy);
+
+        auto *usz = c->builder.getIntNTy(AN_USZ_SIZE);
+        auto *strlenTy = FunctionType::get(usz, {voidPtrTy}, false);
+        auto strlen = c->module->getOrInsertFunction("strlen", strlenTy);
 
-        yy::location lloc = mkLoc(mkPos(0,0,0), mkPos(0,0,0));
-        auto *strlit = new StrLitNode(lloc, n);
+        Value *decl = c->builder.CreateExtractValue(fd.val, 0);
+        Value *name = c->builder.CreateCall(getName, decl);
+        Value *len = c->builder.CreateCall(strlen, name);
 
-        return new TypedValue(CompilingVisitor::compile(c, strlit));
+        AnType *strty = AnDataType::get("Str");
+        Value *str = UndefValue::get(c->anTypeToLlvmType(strty));
+        str = c->builder.CreateInsertValue(str, name, 0);
+        str = c->builder.CreateInsertValue(str, len, 1);
+        return new TypedValue(str, strty);
     }
 
     TypedValue* Ante_sizeof(Compiler *c, TypedValue &tv){
-        auto size = tv.type->typeTag == TT_Type
-                    ? extractTypeValue(tv)->getSizeInBits(c)
-                    : tv.type->getSizeInBits(c);
+        auto *ty = tv.type->typeTag == TT_Type ? extractTypeValue(tv) : tv.type;
 
-        if(!size){
-            cerr << size.getErr() << endl;
-            size = 0;
+        //Use the size of the type's translated layout so that any padding, field
+        //reordering, or alignment is included, eg. for Vec's buffer sizes
+        auto *llvmTy = c->anTypeToLlvmType(ty);
+        size_t size = 0;
+
+        if(llvmTy->isSized()){
+            size = CodegenCtxt::get().dl.getTypeAllocSize(llvmTy);
+        }else{
+            auto bits = ty->getSizeInBits(c);
+            if(!bits) cerr << bits.getErr() << endl;
+            else size = bits.getVal() / 8;
         }
 
-        Value *sizeVal = c->builder.getIntN(AN_USZ_SIZE, size.getVal() / 8);
+        Value *sizeVal = c->builder.getIntN(AN_USZ_SIZE, size);
         return new TypedValue(sizeVal, AnType::getUsz());
     }
 
+    TypedValue* Ante_alignof(Compiler *c, TypedValue &tv){
+        auto *ty = tv.type->typeTag == TT_Type ? extractTypeValue(tv) : tv.type;
+
+        //Includes any alignment set by ![align N], which llvm does not know of
+        unsigned align = getAlignment(c->anTypeToLlvmType(ty));
+        return new TypedValue(c->builder.getIntN(AN_USZ_SIZE, align), AnType::getUsz());
+    }
+
     void* Ante_store(Compiler *c, TypedValue &nameTv, TypedValue &gv){
-        char *name = *(char**)ArgTuple(c, nameTv).asRawData();
+        ArgTuple nameArg{c, nameTv};
+        char *name = *(char**)nameArg.asRawData();
+
+        //The code of a compile-time function, including its parameters, only
+        //has values once it is called, after the stored value would be looked up
+        if(c->isJIT and !isa<Constant>(gv.val)){
+            auto *curfn = c->compCtxt->callStack.empty() ? nullptr : c->compCtxt->callStack.back()->fdn.get();
+            yy::location fakeloc = mkLoc(mkPos(0,0,0), mkPos(0,0,0));
+            c->compErr("Ante.store can only store values known while compiling, but '"
+                    + string(name) + "' is given a value computed at runtime", curfn ? curfn->loc : fakeloc);
+        }
+
         c->ctCtxt->ctStores[name] = gv;
         return nullptr;
     }
 
     TypedValue* Ante_lookup(Compiler *c, TypedValue &nameTv){
-        char *name = *(char**)ArgTuple(c, nameTv).asRawData();
+        ArgTuple nameArg{c, nameTv};
+        char *name = *(char**)nameArg.asRawData();
 
         auto t = c->ctCtxt->ctStores.lookup(name);
         if(t){
@@ -89,8 +134,9 @@ extern "C" {
     }
 
     void* Ante_forget(Compiler *c, TypedValue &msgTv){
-        char *msg = *(char**)ArgTuple(c, msgTv).asRawData();
-        c->mergedCompUnits->fnDecls[msg].clear();
+        ArgTuple msgArg{c, msgTv};
+        char *msg = *(char**)msgArg.asRawData();
+        c->mergedCompUnits->getFnDecls(msg).clear();
         return nullptr;
     }
 }
@@ -102,12 +148,16 @@ namespace ante {
         compapi.emplace("Ante_getAST",      new CtFunc((void*)Ante_getAST,      AnPtrType::get(AnDataType::get("Ante.Node"))));
         compapi.emplace("Ante_debug",       new CtFunc((void*)Ante_debug,       AnType::getVoid(), {AnTypeVarType::get("'t'")}));
         compapi.emplace("Ante_sizeof",      new CtFunc((void*)Ante_sizeof,      AnType::getU32(),  {AnTypeVarType::get("'t'")}));
+        compapi.emplace("Ante_alignof",     new CtFunc((void*)Ante_alignof,     AnType::getU32(),  {AnTypeVarType::get("'t'")}));
         compapi.emplace("Ante_store",       new CtFunc((void*)Ante_store,       AnType::getVoid(), {AnPtrType::get(AnType::getPrimitive(TT_C8)), AnTypeVarType::get("'t'")}));
         compapi.emplace("Ante_lookup",      new CtFunc((void*)Ante_lookup,      AnTypeVarType::get("'t'"), {AnPtrType::get(AnType::getPrimitive(TT_C8))}));
         compapi.emplace("Ante_error",       new CtFunc((void*)Ante_error,       AnType::getVoid(), {AnPtrType::get(AnType::getPrimitive(TT_C8))}));
         compapi.emplace("Ante_emitIR",      new CtFunc((void*)Ante_emitIR,      AnType::getVoid()));
         compapi.emplace("Ante_forget",      new CtFunc((void*)Ante_forget,      AnType::getVoid(), {AnPtrType::get(AnType::getPrimitive(TT_C8))}));
-        compapi.emplace("FuncDecl_getName", new CtFunc((void*)FuncDecl_getName, AnDataType::get("Str"), {AnDataType::get("Ante.FuncDecl")}));
+        compapi.emplace("FuncDecl_getName", new CtFunc((void*)FuncDecl_getName, AnDataType::get("Str"), {AnDataType::get("FuncDecl")}));
+
+        //Called from the JIT by the code of the compapi functions above
+        sys::DynamicLibrary::AddSymbol("ante_FuncDecl_getName", (void*)ante_FuncDecl_getName);
     }
 
     CtFunc::CtFunc(void* f) : fn(f), params(), retty(AnType::getVoid()){}
@@ -2,18 +2,20 @@
 #include <llvm/Support/FileSystem.h>   //for r/w when outputting bitcode
 #include <llvm/Support/raw_ostream.h>  //for ostream when outputting bitcode
 
-#if LLVM_VERSION_MAJOR >= 6
-#include <llvm/Support/raw_os_ostream.h>
-#endif
-
-#include <llvm/Transforms/Scalar.h>    //for most passes
+#include <llvm/Passes/PassBuilder.h>  //for the standard optimization pipelines
+#include <llvm/IR/PassManager.h>
 #include <llvm/IR/LegacyPassManager.h>
-#include <llvm/Support/TargetRegistry.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Linker/Linker.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/CodeGen/ParallelCG.h>
 
 #include <cstdio>
 #include <cstdlib>
@@ -24,6 +26,10 @@
 #include "types.h"
 #include "repl.h"
 #include "target.h"
+#include "codegen.h"
+#include "linker.h"
+#include "escape.h"
+#include "jit.h"
 #include "yyparser.h"
 
 using namespace std;
@@ -158,22 +164,7 @@ void CompilingVisitor::visit(TypeNode *n){
         if(!unionDataTy or unionDataTy->isStub()) goto rettype;
 
         size_t tagIndex = unionDataTy->getTagVal(n->typeName);
-        Value *tag = ConstantInt::get(*c->ctxt, APInt(8, tagIndex, true));
-
-        Type *unionTy = c->anTypeToLlvmType(unionDataTy, true);
-
-        Type *curTy = tag->getType();
-
-        //allocate for the largest possible union member
-        auto *alloca = c->builder.CreateAlloca(unionTy);
-
-        //but make sure to bitcast it to the current member before storing an incorrect type
-        Value *castTo = c->builder.CreateBitCast(alloca, curTy->getPointerTo());
-        c->builder.CreateStore(tag, castTo);
-
-        //load the initial alloca, not the bitcasted one
-        Value *unionVal = c->builder.CreateLoad(alloca);
-        val = TypedValue(unionVal, unionDataTy);
+        val = createUnionValue(c, unionDataTy, tagIndex, nullptr);
         return;
     }
 
@@ -184,6 +175,7 @@ rettype:
     //The TypeNode* address is wrapped in an llvm int so that llvm::Value methods can be called
     //without crashing, even if their result is meaningless
     Value *v = c->builder.getInt64((unsigned long)ty);
+    markHostAddress(ty);
     val =TypedValue(v, AnType::getPrimitive(TT_Type));
 }
 
@@ -278,12 +270,8 @@ TypedValue compStrInterpolation(Compiler *c, StrLitNode *sln, int pos){
                 + " to Str for string interpolation.", valNode->loc);
         }
 
-        if(c->isJIT){
-            val = compileAndCallAnteFunction(c, fd->getName(), fd->mangledName, {val});
-        }else{
-            auto fn = c->getCastFn(val.type, strty, fd);
-            val = TypedValue(c->builder.CreateCall(fn.val, val.val), strty);
-        }
+        auto fn = c->getCastFn(val.type, strty, fd);
+        val = TypedValue(c->builder.CreateCall(fn.val, val.val), strty);
     }
 
     //Finally, the interpolation is done.  Now just combine the three strings
@@ -293,11 +281,6 @@ TypedValue compStrInterpolation(Compiler *c, StrLitNode *sln, int pos){
     auto lstr = CompilingVisitor::compile(c, ls);
     auto rstr = CompilingVisitor::compile(c, rs);
 
-    if(c->isJIT){
-        auto appendL = compileAndCallAnteFunction(c, appendFn, mangledAppendFn, {lstr, val});
-        return compileAndCallAnteFunction(c, appendFn, mangledAppendFn, {appendL, rstr});
-    }
-
     auto fn = c->getFunction(appendFn, mangledAppendFn);
     if(!fn) return c->compErr("++ overload for Str and Str not found while performing Str interpolation."
             "  The prelude may not be imported correctly.", sln->loc);
@@ -383,6 +366,34 @@ TypedValue Compiler::getVoidLiteral(){
     return TypedValue(UndefValue::get(Type::getInt8Ty(*ctxt)), AnType::getVoid());
 }
 
+AllocaInst* Compiler::createEntryBlockAlloca(Type *ty, string const& name){
+    Function *f = builder.GetInsertBlock()->getParent();
+    BasicBlock &entry = f->getEntryBlock();
+
+    //keep the allocas grouped at the start of the entry block
+    auto insertPt = entry.begin();
+    while(insertPt != entry.end() and isa<AllocaInst>(*insertPt))
+        ++insertPt;
+
+    IRBuilder<> entryBuilder{&entry, insertPt};
+    auto *alloca = entryBuilder.CreateAlloca(ty, nullptr, name);
+
+    if(unsigned align = getExplicitAlignment(ty)){
+#if LLVM_VERSION_MAJOR >= 10
+        alloca->setAlignment(Align(align));
+#else
+        alloca->setAlignment(align);
+#endif
+    }
+    return alloca;
+}
+
+GlobalVariable* Compiler::createGlobal(Type *ty, string const& name){
+    auto *global = new GlobalVariable(*module, ty, false, GlobalValue::PrivateLinkage, UndefValue::get(ty), name);
+    alignGlobal(global);
+    return global;
+}
+
 void CompilingVisitor::visit(TupleNode *n){
     //A void value is represented by the empty tuple, ()
     if(n->exprs.empty()){
@@ -571,15 +582,156 @@ void CompilingVisitor::visit(WhileNode *n){
 }
 
 
-void CompilingVisitor::visit(ForNode *n){
+/**
+ * @brief Extracts the field with the given name from val, a value of data type dt
+ */
+TypedValue extractField(Compiler *c, TypedValue const& val, AnDataType *dt, string name){
+    int index = dt->getFieldIndex(name);
+    auto *ev = c->builder.CreateExtractValue(val.val, dt->getLlvmFieldIndex(index));
+    return TypedValue(ev, dt->extTys[index]);
+}
+
+
+/**
+ * @brief Compiles a for loop counting from start to end (exclusive) by step as
+ * a single phi induction variable rather than through the Iterator trait,
+ * giving the loop optimizers a canonical loop they can analyze and vectorize.
+ *
+ * @param elem Maps the induction variable to the value bound to the loop variable
+ */
+void compCountedFor(CompilingVisitor &cv, ForNode *n, TypedValue start, Value *end, Value *step,
+        bool isSigned, function<TypedValue(TypedValue)> elem){
+
+    Compiler *c = cv.c;
     Function *f = c->builder.GetInsertBlock()->getParent();
+    BasicBlock *preheader = c->builder.GetInsertBlock();
     BasicBlock *cond  = BasicBlock::Create(*c->ctxt, "for_cond", f);
     BasicBlock *begin = BasicBlock::Create(*c->ctxt, "for", f);
     BasicBlock *incr = BasicBlock::Create(*c->ctxt, "for_incr", f);
-    BasicBlock *end   = BasicBlock::Create(*c->ctxt, "end_for", f);
+    BasicBlock *endbb = BasicBlock::Create(*c->ctxt, "end_for", f);
 
+    c->builder.CreateBr(cond);
+    c->builder.SetInsertPoint(cond);
+
+    PHINode *iv = c->builder.CreatePHI(start.getType(), 2, "i");
+    iv->addIncoming(start.val, preheader);
+
+    //mirrors Range.has_next, the direction is usually known from a constant step
+    Value *hasNext;
+    auto *constStep = dyn_cast<ConstantInt>(step);
+    if(constStep and constStep->isZero()){
+        hasNext = c->builder.getFalse();
+    }else if(constStep and constStep->isNegative()){
+        hasNext = c->builder.CreateICmpSGT(iv, end);
+    }else if(constStep){
+        hasNext = isSigned ? c->builder.CreateICmpSLT(iv, end) : c->builder.CreateICmpULT(iv, end);
+    }else{
+        auto *zero = ConstantInt::get(step->getType(), 0);
+        hasNext = c->builder.CreateSelect(c->builder.CreateICmpSGT(step, zero),
+                c->builder.CreateICmpSLT(iv, end),
+                c->builder.CreateAnd(c->builder.CreateICmpSLT(step, zero), c->builder.CreateICmpSGT(iv, end)));
+    }
+    c->builder.CreateCondBr(hasNext, begin, endbb);
+    c->builder.SetInsertPoint(begin);
+
+    auto uwrap = elem(TypedValue(iv, start.type));
+    c->stoVar(n->var, new Variable(n->var, uwrap, c->scope));
+
+    c->compCtxt->breakLabels->push_back(endbb);
+    c->compCtxt->continueLabels->push_back(incr);
+
+    try{
+        n->child->accept(cv);
+    }catch(CtError *e){
+        c->compCtxt->breakLabels->pop_back();
+        c->compCtxt->continueLabels->pop_back();
+        throw e;
+    }
+
+    c->compCtxt->breakLabels->pop_back();
+    c->compCtxt->continueLabels->pop_back();
+
+    if(!cv.val) return;
+    if(!dyn_cast<ReturnInst>(cv.val.val) and !dyn_cast<BranchInst>(cv.val.val))
+        c->builder.CreateBr(incr);
+
+    //incr is always completed as continue may branch to it even if the body does not
+    c->builder.SetInsertPoint(incr);
+    iv->addIncoming(c->builder.CreateAdd(iv, step), incr);
+    c->builder.CreateBr(cond);
+
+    c->builder.SetInsertPoint(endbb);
+    cv.val = c->getVoidLiteral();
+}
+
+
+/**
+ * @brief Returns the DataType declared as tyname in the given file of the
+ * standard library, or nullptr if that file has not been compiled.
+ */
+AnDataType* lookupStdlibType(string const& file, string const& tyname){
+    auto it = allCompiledModules.find(AN_LIB_DIR + file);
+    if(it == allCompiledModules.end())
+        return nullptr;
+
+    return it->getValue()->getUserType(tyname);
+}
+
+
+/**
+ * @brief Lowers loops over a Range or a Vec into counted loops.
+ *
+ * @return true if the loop was compiled, or false if it should
+ * instead be compiled through the Iterator trait.
+ */
+bool tryCompCountedFor(CompilingVisitor &cv, ForNode *n, TypedValue &rangev){
+    auto *dt = dyn_cast<AnDataType>(rangev.type);
+    if(!dt or dt->isGeneric or dt->typeTag != TT_Data)
+        return false;
+
+    Compiler *c = cv.c;
+    //Compare against the declarations themselves so that user types
+    //which happen to be named Range or Vec go through the Iterator trait
+    if(dt == lookupStdlibType("prelude.an", "Range")){
+        auto start = extractField(c, rangev, dt, "start");
+        auto end = extractField(c, rangev, dt, "end");
+        auto step = extractField(c, rangev, dt, "step");
+
+        compCountedFor(cv, n, start, end.val, step.val, true,
+                [](TypedValue i){ return i; });
+        return true;
+    }
+
+    //Equivalent to iterating through the VecIter returned by Vec.into_iter
+    if(dt->unboundType and dt->unboundType == lookupStdlibType("vec.an", "Vec")){
+        auto data = extractField(c, rangev, dt, "_data");
+        auto len = extractField(c, rangev, dt, "len");
+        auto *elemTy = ((AnPtrType*)data.type)->extTy;
+        auto start = TypedValue(ConstantInt::get(len.getType(), 0), len.type);
+
+        compCountedFor(cv, n, start, len.val, ConstantInt::get(len.getType(), 1), false,
+                [&](TypedValue i){
+                    auto *ptr = c->builder.CreateInBoundsGEP(data.val, i.val);
+                    return TypedValue(c->builder.CreateLoad(ptr), elemTy);
+                });
+        return true;
+    }
+    return false;
+}
+
+
+void CompilingVisitor::visit(ForNode *n){
     auto rangev = CompilingVisitor::compile(c, n->range);
 
+    if(tryCompCountedFor(*this, n, rangev))
+        return;
+
+    Function *f = c->builder.GetInsertBlock()->getParent();
+    BasicBlock *cond  = BasicBlock::Create(*c->ctxt, "for_cond", f);
+    BasicBlock *begin = BasicBlock::Create(*c->ctxt, "for", f);
+    BasicBlock *incr = BasicBlock::Create(*c->ctxt, "for_incr", f);
+    BasicBlock *end   = BasicBlock::Create(*c->ctxt, "end_for", f);
+
     //check if the range expression is its own iterator and thus implements Iterator
     //If it does not, see if it implements Iterable by attempting to call into_iter on it
     auto *dt = dyn_cast<AnDataType>(rangev.type);
@@ -597,7 +749,7 @@ void CompilingVisitor::visit(ForNode *n){
     //by this point, rangev now properly stores the range information,
     //so store it on the stack and insert calls to unwrap, has_next,
     //and next at the beginning, beginning, and end of the loop respectively.
-    Value *alloca = c->builder.CreateAlloca(rangev.getType());
+    Value *alloca = c->createEntryBlockAlloca(rangev.getType());
     c->builder.CreateStore(rangev.val, alloca);
 
     c->builder.CreateBr(cond);
@@ -786,9 +938,8 @@ TypedValue compVarDeclWithInferredType(VarDeclNode *node, Compiler *c){
 
     //location to store var
     Value *ptr = isGlobal ?
-            (Value*) new GlobalVariable(*c->module, val.getType(), false,
-                    GlobalValue::PrivateLinkage, UndefValue::get(val.getType()), node->name) :
-            c->builder.CreateAlloca(val.getType(), nullptr, node->name.c_str());
+            (Value*) c->createGlobal(val.getType(), node->name) :
+            c->createEntryBlockAlloca(val.getType(), node->name);
 
     TypedValue alloca{ptr, val.type};
 
@@ -836,8 +987,8 @@ TypedValue compMutVarDecl(VarDeclNode *n, CompilingVisitor &v){
 
     //location to store var
     Value *loc = isGlobal ?
-        (Value*) new GlobalVariable(*v.c->module, ty, false, GlobalValue::PrivateLinkage, UndefValue::get(ty), n->name) :
-        v.c->builder.CreateAlloca(ty, nullptr, n->name.c_str());
+        (Value*) v.c->createGlobal(ty, n->name) :
+        v.c->createEntryBlockAlloca(ty, n->name);
 
     TypedValue alloca = TypedValue(loc, anTy);
 
@@ -899,13 +1050,13 @@ void CompilingVisitor::visit(VarDeclNode *n){
 
     if(isGlobal){
         auto *ty = c->anTypeToLlvmType(val.type);
-        auto *global = new GlobalVariable(*c->module, ty, false, GlobalValue::PrivateLinkage, UndefValue::get(ty), n->name);
+        auto *global = c->createGlobal(ty, n->name);
         c->builder.CreateStore(val.val, global);
         val.val = global;
     }
 
     if(val.getType()->isArrayTy() and not isGlobal){
-        Value *alloca = c->builder.CreateAlloca(val.getType(), nullptr, n->name.c_str());
+        Value *alloca = c->createEntryBlockAlloca(val.getType(), n->name);
         c->builder.CreateStore(val.val, alloca);
         val.val = alloca;
         isGlobal = true;
@@ -983,7 +1134,8 @@ TypedValue compFieldInsert(Compiler *c, BinOpNode *bop, Node *expr){
                         " to a variable of type " + anTypeToColoredStr(indexTy), expr->loc);
 
             Value *nv = newval.val;
-            Type *nt = val->getType()->getStructElementType(index);
+            unsigned llvmIndex = dataTy->getLlvmFieldIndex(index);
+            Type *nt = val->getType()->getStructElementType(llvmIndex);
 
             //Type check may succeed if a void* is being inserted into any ptr slot,
             //but llvm will still complain so we create a bit cast to appease it
@@ -991,7 +1143,7 @@ TypedValue compFieldInsert(Compiler *c, BinOpNode *bop, Node *expr){
                 nv = c->builder.CreateBitCast(nv, nt);
             }
 
-            auto *ins = c->builder.CreateInsertValue(val, nv, index);
+            auto *ins = c->builder.CreateInsertValue(val, nv, llvmIndex);
 
             c->builder.CreateStore(ins, var);
             return c->getVoidLiteral();
@@ -1219,8 +1371,8 @@ void CompilingVisitor::visit(ExtNode *n){
                 shared_ptr<FuncDecl> fd{new FuncDecl(spfdn, mangledName, c->scope, c->mergedCompUnits)};
                 traitImpl->funcs.emplace_back(fd);
 
-                c->compUnit->fnDecls[fdn->name].emplace_back(fd);
-                c->mergedCompUnits->fnDecls[fdn->name].emplace_back(fd);
+                c->compUnit->getFnDecls(fdn->name).emplace_back(fd);
+                c->mergedCompUnits->getFnDecls(fdn->name).emplace_back(fd);
             }
 
             //trait is fully implemented, add it to the DataType
@@ -1271,6 +1423,51 @@ vector<AnTypeVarType*> toVec(Compiler *c, const vector<unique_ptr<TypeNode>> &ge
 
 void addGenerics(vector<AnTypeVarType*> &dest, vector<AnType*> &src);
 
+/**
+ * @brief Applies the layout directives preceding a data declaration to its type
+ *
+ * ![packed] removes all padding, ![extern] keeps the fields in declaration order
+ * (eg. to match a C struct) instead of reordering them to minimize padding, and
+ * ![align N] or ![cache_aligned] raise the type's alignment.
+ */
+void applyLayoutDirectives(Compiler *c, AnDataType *data, DataDeclNode *n){
+    for(Node *m = n->modifiers.get(); m; m = m->next.get()){
+        auto *mod = (ModNode*)m;
+        if(!mod->isCompilerDirective()) continue;
+
+        if(data->typeTag == TT_TaggedUnion)
+            c->compErr("Layout directives cannot be applied to union types", mod->loc);
+
+        Node *expr = mod->expr.get();
+        if(VarNode *vn = dynamic_cast<VarNode*>(expr)){
+            if(vn->name == "packed")
+                data->isPacked = true;
+            else if(vn->name == "extern")
+                data->keepFieldOrder = true;
+            else if(vn->name == "cache_aligned")
+                data->alignment = AN_CACHE_LINE_SIZE;
+            else
+                c->compErr("Unrecognized compiler directive '"+vn->name+"'", vn->loc);
+            continue;
+        }
+
+        //![align N]
+        auto *bop = dynamic_cast<BinOpNode*>(expr);
+        auto *fn = bop and bop->op == '(' ? dynamic_cast<VarNode*>(bop->lval.get()) : nullptr;
+        if(!fn or fn->name != "align")
+            c->compErr("Unrecognized compiler directive", mod->loc);
+
+        auto *args = dynamic_cast<TupleNode*>(bop->rval.get());
+        auto *lit = args and args->exprs.size() == 1 ? dynamic_cast<IntLitNode*>(args->exprs[0].get()) : nullptr;
+        unsigned long align = lit ? stoul(lit->val) : 0;
+
+        if(align == 0 or (align & (align - 1)))
+            c->compErr("The alignment of ![align N] must be an integer literal power of 2", bop->rval->loc);
+
+        data->alignment = align;
+    }
+}
+
 /**
  * @brief A helper function to compile tagged union declarations
  *
@@ -1289,6 +1486,13 @@ TypedValue compTaggedUnion(Compiler *c, DataDeclNode *n){
     vector<AnType*> unionTypes;
     AnDataType *data = AnDataType::create(union_name, {}, true, toVec(c, n->generics));
 
+    size_t numTags = 0;
+    for(auto *tagNode = nvn; tagNode; tagNode = (NamedValNode*)tagNode->next.get())
+        numTags++;
+
+    auto tagBits = getUnionTagBits(numTags);
+    AnType *tagValTy = AnType::getPrimitive(tagBits == 8 ? TT_U8 : tagBits == 16 ? TT_U16 : TT_U32);
+
     while(nvn){
         TypeNode *tyn = (TypeNode*)nvn->typeExpr.get();
         AnType *tagTy = tyn->extTy ? toAnType(c, tyn->extTy.get()) : AnType::getVoid();
@@ -1300,8 +1504,9 @@ TypedValue compTaggedUnion(Compiler *c, DataDeclNode *n){
             exts.push_back(tagTy);
         }
 
-        //Each union member's type is a tuple of the tag (a u8 value), and the user-defined value
-        auto *tup = AnAggregateType::get(TT_Tuple, {AnType::getU8(), tagTy});
+        //Each union member's type is a tuple of the tag (the smallest unsigned int that
+        //fits each tag), and the user-defined value
+        auto *tup = AnAggregateType::get(TT_Tuple, {tagValTy, tagTy});
 
         //Store the tag as a UnionTag and a AnDataType
         AnDataType *tagdt = AnDataType::create(nvn->name, exts, false, toVec(c, n->generics));
@@ -1327,6 +1532,7 @@ TypedValue compTaggedUnion(Compiler *c, DataDeclNode *n){
 
     data->tags = tags;
     data->isAlias = n->isAlias;
+    applyLayoutDirectives(c, data, n);
 
     for(auto &v : data->variants){
         v->extTys = data->extTys;
@@ -1361,8 +1567,10 @@ void CompilingVisitor::visit(DataDeclNode *n){
     //just to cause an error if something tries to use the stub
     AnDataType *data = AnDataType::create(n->name, {}, false, toVec(c, n->generics));
 
-    if(data->llvmType)
+    if(data->llvmType){
         data->llvmType = nullptr;
+        data->fieldIndices.clear();
+    }
 
     c->stoType(data, n->name);
 
@@ -1387,6 +1595,7 @@ void CompilingVisitor::visit(DataDeclNode *n){
     data->fields = fieldNames;
     data->extTys = fieldTypes;
     data->isAlias = n->isAlias;
+    applyLayoutDirectives(c, data, n);
 
     for(auto &v : data->variants){
         v->extTys = data->extTys;
@@ -1492,7 +1701,7 @@ void CompilingVisitor::visit(MatchBranchNode *n){
 void ante::Module::import(ante::Module *mod){
     for(auto& pair : mod->fnDecls)
         for(auto& fd : pair.second)
-            fnDecls[pair.first()].push_back(fd);
+            getFnDecls(pair.first()).push_back(fd);
 
     for(auto& pair : mod->userTypes)
         userTypes[pair.first()] = pair.second;
@@ -1501,6 +1710,40 @@ void ante::Module::import(ante::Module *mod){
         traits[pair.first()] = pair.second;
 }
 
+
+vector<shared_ptr<FuncDecl>>& ante::Module::getFnDecls(StringRef name){
+    auto it = fnDecls.find(name);
+    if(it != fnDecls.end() or !parent)
+        return fnDecls[name];
+
+    //Copy the FuncDecls so that they are not marked as compiled in the parent
+    //when they are compiled into a different llvm::Module here
+    auto &decls = fnDecls[name];
+    for(auto &fd : parent->getFnDecls(name)){
+        auto fd_cpy = make_shared<FuncDecl>(fd->fdn, fd->mangledName, fd->scope, this);
+        fd_cpy->obj = fd->obj;
+        fd_cpy->obj_bindings = fd->obj_bindings;
+        decls.push_back(fd_cpy);
+    }
+    return decls;
+}
+
+
+AnDataType* ante::Module::getUserType(StringRef name) const{
+    auto it = userTypes.find(name);
+    if(it != userTypes.end())
+        return it->getValue();
+    return parent ? parent->getUserType(name) : nullptr;
+}
+
+
+Trait* ante::Module::getTrait(StringRef name) const{
+    auto it = traits.find(name);
+    if(it != traits.end())
+        return it->getValue().get();
+    return parent ? parent->getTrait(name) : nullptr;
+}
+
 inline bool fileExists(const string &fName){
     if(FILE *f = fopen(fName.c_str(), "r")){
         fclose(f);
@@ -1629,6 +1872,10 @@ string removeFileExt(string file){
     return index == string::npos ? file : file.substr(0, index);
 }
 
+bool isBitcodeFile(string const& file){
+    return file.size() > 3 and file.compare(file.size() - 3, 3, ".bc") == 0;
+}
+
 
 template<typename T>
 void compileAll(Compiler *c, vector<T> &vec){
@@ -1654,10 +1901,17 @@ void Compiler::scanAllDecls(RootNode *root){
 		}
 	}
 
+    bool wasBatching = ctCtxt->batchFnDecls;
+    ctCtxt->batchFnDecls = true;
+
     compileAll(this, n->types);
     compileAll(this, n->traits);
     compileAll(this, n->extensions);
 	compileAll(this, n->funcs);
+
+    ctCtxt->batchFnDecls = wasBatching;
+    if(!wasBatching)
+        runFnDeclHooks();
 }
 
 void Compiler::eval(){
@@ -1721,8 +1975,8 @@ Function* Compiler::createMainFn(){
 
     //TODO: merge this code with Compiler::registerFunction
     shared_ptr<FuncDecl> fd{main_var};
-    compUnit->fnDecls[fnName].push_back(fd);
-    mergedCompUnits->fnDecls[fnName].push_back(fd);
+    compUnit->getFnDecls(fnName).push_back(fd);
+    mergedCompUnits->getFnDecls(fnName).push_back(fd);
 
     compCtxt->callStack.push_back(main_var);
     return main;
@@ -1747,43 +2001,114 @@ void CompilingVisitor::visit(RootNode *n){
 }
 
 /**
- * @brief Fills the given PassManager with passes appropriate
- * for the given optLvl.
+ * @brief Translates an optLvl and sizeLvl into the corresponding
+ * level of LLVM's standard optimization pipelines.
+ */
+PassBuilder::OptimizationLevel toPipelineLevel(unsigned int optLvl, unsigned int sizeLvl){
+    if(sizeLvl == 1) return PassBuilder::OptimizationLevel::Os;
+    if(sizeLvl >= 2) return PassBuilder::OptimizationLevel::Oz;
+
+    switch(optLvl){
+        case 0:  return PassBuilder::OptimizationLevel::O0;
+        case 1:  return PassBuilder::OptimizationLevel::O1;
+        case 2:  return PassBuilder::OptimizationLevel::O2;
+        default: return PassBuilder::OptimizationLevel::O3;
+    }
+}
+
+/**
+ * @brief Runs LLVM's standard per-module optimization pipeline for the
+ * given optimization level over mod.
  *
- * @param pm The PassManager to add passes to
+ * @param mod The module to optimize
  * @param optLvl The optimization level in the range 0..3.
- * Determines which passes should be added.  With 3 being
- * all passes.
+ * @param sizeLvl 1 to optimize for size (-Os), 2 to aggressively
+ * optimize for size (-Oz), or 0 to optimize for speed.
+ * @param lto If set, the link-time pipeline for the given mode is run
+ * instead as mod is expected to already contain the whole program.
  */
-inline void addPasses(legacy::PassManager &pm, char optLvl){
-    if(optLvl > 0){
-        if(optLvl >= 3){
-            pm.add(createLoopStrengthReducePass());
-            pm.add(createLoopUnrollPass());
-            pm.add(createMergedLoadStoreMotionPass());
-            pm.add(createMemCpyOptPass());
-            pm.add(createSpeculativeExecutionPass());
-        }
-        //pm.add(createAlwaysInlinerLegacyPass());
-        pm.add(createDeadStoreEliminationPass());
-        pm.add(createDeadCodeEliminationPass());
-        pm.add(createCFGSimplificationPass());
-        pm.add(createTailCallEliminationPass());
-        pm.add(createInstructionSimplifierPass());
-
-#if LLVM_VERSION_MAJOR < 5
-        pm.add(createLoadCombinePass());
+void optimizeModule(llvm::Module *mod, unsigned int optLvl, unsigned int sizeLvl, LtoMode lto, bool preLink){
+    auto &cg = CodegenCtxt::get();
+
+    //The vectorizers and cost models need to know the target to do anything useful
+    cg.configureModule(mod);
+
+    PassBuilder pb{cg.tm.get()};
+    LoopAnalysisManager lam;
+    FunctionAnalysisManager fam;
+    CGSCCAnalysisManager cgam;
+    ModuleAnalysisManager mam;
+
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+    auto lvl = toPipelineLevel(optLvl, sizeLvl);
+
+    //The default pipeline requires optimizations to be requested, at -O0
+    //only !inline functions are inlined
+    ModulePassManager mpm;
+    if(lvl == PassBuilder::OptimizationLevel::O0)
+        mpm.addPass(AlwaysInlinerPass());
+#if LLVM_VERSION_MAJOR >= 6
+    else if(preLink and lto == LtoMode::Full)
+        mpm = pb.buildLTOPreLinkDefaultPipeline(lvl, false);
+    else if(preLink and lto == LtoMode::Thin)
+        mpm = pb.buildThinLTOPreLinkDefaultPipeline(lvl, false);
+    else if(lto == LtoMode::Full)
+        mpm = pb.buildLTODefaultPipeline(lvl, false, nullptr);
+    else if(lto == LtoMode::Thin)
+        mpm = pb.buildThinLTODefaultPipeline(lvl, false, nullptr);
+#else
+    else if(preLink and lto == LtoMode::Full)
+        mpm = pb.buildLTOPreLinkDefaultPipeline(lvl);
+    else if(preLink and lto == LtoMode::Thin)
+        mpm = pb.buildThinLTOPreLinkDefaultPipeline(lvl);
+    else if(lto == LtoMode::Full)
+        mpm = pb.buildLTODefaultPipeline(lvl);
+    else if(lto == LtoMode::Thin)
+        mpm = pb.buildThinLTODefaultPipeline(lvl);
 #endif
-        pm.add(createLoopLoadEliminationPass());
-        pm.add(createReassociatePass());
-        pm.add(createPromoteMemoryToRegisterPass());
+    else
+        mpm = pb.buildPerModuleDefaultPipeline(lvl);
+
+    mpm.run(*mod, mam);
+}
 
-        //Instruction Combining Pass seems to break nested for loops
-        //pm.add(createInstructionCombiningPass());
+
+/**
+ * @brief Moves the heap allocations which never escape their function
+ * onto the stack for every function in the module.
+ */
+void heapToStack(Compiler *c){
+    for(auto &f : *c->module){
+        unsigned promoted = promoteHeapAllocations(&f);
+
+        if(c->remarks and promoted > 0)
+            cerr << "remark: " << f.getName().str() << ": moved " << promoted
+                 << (promoted == 1 ? " heap allocation" : " heap allocations") << " to the stack\n";
     }
 }
 
 
+/**
+ * @brief Reports each function marked ![inline] which still has calls
+ * remaining after optimization, eg. because it is recursive.
+ */
+void reportFailedInlines(Compiler *c){
+    for(auto &fn : c->inlineFns){
+        auto *f = dyn_cast_or_null<Function>((Value*)fn);
+        if(!f or f->getParent() != c->module.get()) continue;
+
+        size_t calls = count_if(f->user_begin(), f->user_end(), [](User *u){ return isa<CallInst>(u); });
+        if(calls > 0)
+            cerr << "remark: " << f->getName().str() << ": marked ![inline] but " << calls
+                 << (calls == 1 ? " call" : " calls") << " could not be inlined\n";
+    }
+}
+
 
 void Compiler::compile(){
     if(compiled){
@@ -1800,10 +2125,22 @@ void Compiler::compile(){
     //always return 0
     builder.CreateRet(ConstantInt::get(*ctxt, APInt(32, 0)));
 
+    recordTargetCpu(module.get());
+
+    if(!errFlag and optLvl > 0)
+        heapToStack(this);
+
     if(!errFlag and !isLib){
-        legacy::PassManager pm;
-        addPasses(pm, optLvl);
-        pm.run(*module);
+        //With lto set the module is only prepared for linking here.  The whole
+        //program is linked and optimized by optimizeWholeProgram once it is
+        //known an executable is being made rather than an object with -c
+        optimizeModule(module.get(), optLvl, sizeLvl, lto, lto != LtoMode::None);
+
+        if(remarks){
+            if(lto == LtoMode::None)
+                reportFailedInlines(this);
+            reportMetaFunctionCache();
+        }
     }
 
     //flag this module as compiled.
@@ -1816,101 +2153,350 @@ void Compiler::compile(){
 }
 
 
+/**
+ * @brief Compiles a module into an in-memory object file
+ *
+ * @return 0 on success
+ */
+int compileIRtoBuffer(llvm::Module *mod, SmallVectorImpl<char> &obj){
+    auto *tm = CodegenCtxt::get().tm.get();
+    CodegenCtxt::get().configureModule(mod);
+
+    raw_svector_ostream out{obj};
+    legacy::PassManager pm;
+
+#if LLVM_VERSION_MAJOR >= 7
+    bool failed = tm->addPassesToEmitFile(pm, out, nullptr, TargetMachine::CGFT_ObjectFile);
+#else
+    bool failed = tm->addPassesToEmitFile(pm, out, TargetMachine::CGFT_ObjectFile);
+#endif
+
+    if(failed){
+        cerr << "Error when compiling to object: the target cannot emit object files\n";
+        return 1;
+    }
+
+    pm.run(*mod);
+    return 0;
+}
+
+
+int Compiler::optimizeWholeProgram(){
+    if(lto == LtoMode::None) return 0;
+
+    if(linkLtoInputs()){
+        errFlag = true;
+        return 1;
+    }
+
+    optimizeModule(module.get(), optLvl, sizeLvl, lto, false);
+
+    if(remarks)
+        reportFailedInlines(this);
+    return 0;
+}
+
+
 void Compiler::compileNative(){
     if(!compiled) compile();
+    if(optimizeWholeProgram()) return;
+
+    //Link straight from memory when possible, falling back to the system linker
+    if(canLinkInProcess() and jobs <= 1){
+        SmallVector<char, 0> obj;
+        if(compileIRtoBuffer(module.get(), obj))
+            return;
+
+        if(linkInProcess(obj, outFile, dynamicLink) >= 0)
+            return;
+    }
 
     //this file will become the obj file before linking
     string objFile = outFile + ".o";
 
     if(!compileIRtoObj(module.get(), objFile)){
-        linkObj(objFile, outFile);
+        linkObj(objFile, outFile, dynamicLink);
         remove(objFile.c_str());
     }
 }
 
+int Compiler::runJit(vector<string> const& programArgs){
+    if(!compiled) compile();
+    if(errFlag or optimizeWholeProgram()) return 1;
+
+    //main takes a mutable, null-terminated argv whose first element is the program name
+    vector<string> argStrs{outFile};
+    argStrs.insert(argStrs.end(), programArgs.begin(), programArgs.end());
+
+    vector<char*> argv;
+    for(auto &arg : argStrs)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    //A separate JIT from the compile-time session, sharing its on-disk object cache.
+    //The program was already optimized at optLvl by compile, so it is compiled
+    //as a whole rather than lazily and tiered up.
+    JIT jit;
+    module->setTargetTriple(jit.getTargetMachine().getTargetTriple().str());
+    module->setDataLayout(jit.getTargetMachine().createDataLayout());
+    jit.addModuleEagerly(move(module), optLvl);
+
+    auto mainFn = (int(*)(int, char**))jit.getSymbolAddress("main");
+    if(!mainFn){
+        cerr << "JIT Error: main function was not found\n";
+        return 1;
+    }
+
+    int ret = mainFn((int)argStrs.size(), argv.data());
+    fflush(stdout);
+    return ret;
+}
+
+/** @brief Quotes s so a shell passes it as a single argument */
+string quoteShellArg(string const& s){
+#ifdef _WIN32
+    return "\"" + s + "\"";
+#else
+    string ret = "'";
+    for(char c : s){
+        if(c == '\'') ret += "'\\''";
+        else ret += c;
+    }
+    return ret + "'";
+#endif
+}
+
 int Compiler::compileObj(string &outName){
     if(!compiled) compile();
 
     string modName = removeFileExt(fileName);
-    string objFile = outName.length() > 0 ? outName : modName + ".o";
 
+    if(lto != LtoMode::None){
+        string bcFile = outName.length() > 0 ? outName : modName + ".bc";
+
+        std::error_code errCode;
+        raw_fd_ostream out{bcFile, errCode, sys::fs::OpenFlags::F_None};
+        if(errCode){
+            cerr << "Error when compiling to bitcode: " << errCode.message() << endl;
+            return 1;
+        }
+
+        CodegenCtxt::get().configureModule(module.get());
+
+#if LLVM_VERSION_MAJOR >= 7
+        WriteBitcodeToFile(*module, out);
+#else
+        WriteBitcodeToFile(module.get(), out);
+#endif
+        return 0;
+    }
+
+    string objFile = outName.length() > 0 ? outName : modName + ".o";
     return compileIRtoObj(module.get(), objFile);
 }
 
 
-const Target* getTarget(){
-    LLVMInitializeNativeTarget();
-    LLVMInitializeNativeAsmPrinter();
-    string err = "";
+/**
+ * @brief Returns the name of each function defined in mod that was compiled from
+ * a declaration of an import, such as the prelude, rather than of the program itself.
+ */
+StringSet<> getImportedDefinitions(ante::Module *program, llvm::Module *mod){
+    StringSet<> ret;
+    for(auto &entry : program->fnDecls){
+        for(auto &fd : entry.getValue()){
+            if(fd->module == program) continue;
+
+            auto *f = dyn_cast_or_null<Function>(fd->tv.val);
+            if(f and f->getParent() == mod and !f->isDeclaration())
+                ret.insert(f->getName());
+        }
+    }
+    return ret;
+}
 
-    string triple = Triple(AN_NATIVE_ARCH, AN_NATIVE_VENDOR, AN_NATIVE_OS).getTriple();
-    const Target* target = TargetRegistry::lookupTarget(triple, err);
 
-    if(!err.empty()){
-        cerr << err << endl;
-		cerr << "Selected triple: " << AN_NATIVE_ARCH ", " AN_NATIVE_VENDOR ", " AN_NATIVE_OS << endl;
-		cout << "\nRegistered targets:" << endl;
-#if LLVM_VERSION_MAJOR >= 6
-        llvm::raw_os_ostream os{std::cout};
-		TargetRegistry::printRegisteredTargetsForVersion(os);
-#else
-		TargetRegistry::printRegisteredTargetsForVersion();
-#endif
-        exit(1);
+/**
+ * @brief Turns each function defined in both dest and src by a shared import into a
+ * declaration within src so that linking the two does not fail with duplicate definitions.
+ *
+ * This happens for each function from the prelude or another shared import
+ * as every module compiled separately contains its own copy.  Generic
+ * instantiations are linkonce_odr and are left for the linker to fold.
+ * Any other function or global defined in both is reported as an error.
+ *
+ * @param imported The functions of dest compiled from an import, see getImportedDefinitions
+ * @param file The file src was read from, used in error messages
+ * @param instantiations Incremented for each duplicate generic instantiation
+ *
+ * @return 0 on success, 1 if src and dest both define the same symbol
+ */
+int dropDuplicateDefinitions(llvm::Module *dest, llvm::Module *src, StringSet<> const& imported,
+        string const& file, size_t &instantiations){
+    int ret = 0;
+    auto reportDuplicate = [&](GlobalValue &gv){
+        cerr << "Error: " << file << " and the program both define " << gv.getName().str() << endl;
+        ret = 1;
+    };
+
+    for(auto &f : *src){
+        if(f.isDeclaration() or f.hasLocalLinkage()) continue;
+
+        auto *existing = dest->getFunction(f.getName());
+        if(existing and !existing->isDeclaration()){
+            if(f.hasLinkOnceODRLinkage()){
+                instantiations++;
+            }else if(imported.count(f.getName())){
+                f.deleteBody();
+            }else{
+                reportDuplicate(f);
+            }
+        }
     }
 
-    return target;
+    for(auto &g : src->globals()){
+        if(g.isDeclaration() or g.hasLocalLinkage() or g.hasLinkOnceODRLinkage()) continue;
+
+        auto *existing = dest->getGlobalVariable(g.getName());
+        if(existing and !existing->isDeclaration())
+            reportDuplicate(g);
+    }
+    return ret;
 }
 
-TargetMachine* getTargetMachine(){
-    auto *target = getTarget();
 
-    string cpu = "";
-    string features = "";
-    string triple = Triple(AN_NATIVE_ARCH, AN_NATIVE_VENDOR, AN_NATIVE_OS).getTriple();
-    TargetOptions op;
+int Compiler::linkLtoInputs(){
+    Linker linker{*module};
 
-#if LLVM_VERSION_MAJOR >= 6
-    TargetMachine *tm = target->createTargetMachine(triple, cpu, features, op, Reloc::Model::Static,
-            None, CodeGenOpt::Level::Aggressive);
-#else
-    TargetMachine *tm = target->createTargetMachine(triple, cpu, features, op, Reloc::Model::Static,
-            CodeModel::Default, CodeGenOpt::Level::Aggressive);
-#endif
+    //In thin mode only the definitions referenced by the program are linked in
+    unsigned flags = lto == LtoMode::Thin ? Linker::Flags::LinkOnlyNeeded : Linker::Flags::None;
+    size_t instantiations = 0;
+    auto imported = getImportedDefinitions(mergedCompUnits, module.get());
 
-    if(!tm){
-        cerr << "Error when initializing TargetMachine.\n";
-        exit(1);
+    for(auto &file : ltoInputs){
+        auto buf = MemoryBuffer::getFile(file);
+        if(!buf){
+            cerr << "Error when reading " << file << ": " << buf.getError().message() << endl;
+            return 1;
+        }
+
+        auto src = parseBitcodeFile(buf.get()->getMemBufferRef(), *ctxt);
+        if(!src){
+            logAllUnhandledErrors(src.takeError(), errs(), "Error when reading " + file + ": ");
+            return 1;
+        }
+
+        if(!matchesTargetCpu(src.get().get())){
+            cerr << "Error: " << file << " was compiled for a different cpu than the one selected ("
+                 << getTargetCpuIdent() << ").  Recompile it with the same -march, -mcpu, and -mattr\n";
+            return 1;
+        }
+
+        if(dropDuplicateDefinitions(module.get(), src.get().get(), imported, file, instantiations))
+            return 1;
+
+        if(linker.linkInModule(move(src.get()), flags)){
+            cerr << "Error when linking " << file << endl;
+            return 1;
+        }
     }
 
-    return tm;
+    if(remarks and instantiations > 0)
+        cerr << "remark: folded " << instantiations << " duplicate generic "
+             << (instantiations == 1 ? "instantiation" : "instantiations") << " between -flto inputs\n";
+
+    //Only main needs to be visible outside the program, letting the optimizer
+    //inline, specialize, or remove every other definition
+    internalizeModule(*module, [](const GlobalValue &gv){
+        return gv.getName() == "main";
+    });
+    return 0;
 }
 
 
 void Compiler::jitFunction(Function *f){
-    if(!jit.get()){
-        auto* eBuilder = new EngineBuilder(unique_ptr<llvm::Module>(module.get()));
+    auto &jit = JIT::getSession();
+
+    //Each module shares one JIT session, so as with the AnteCall drivers f needs a
+    //unique name and everything else is made internal to not clash with other modules
+    string name = jit.getUniqueName("AnteRun", getModuleName() + '\0' + f->getName().str());
+    f->setName(name);
+
+    module->setDataLayout(jit.getTargetMachine().createDataLayout());
+    internalizeModule(*module, [&](const GlobalValue &gv){
+        return gv.getName() == name;
+    });
 
-        string err;
+    jit.addModule(move(module));
 
-        jit.reset(eBuilder->setErrorStr(&err).setEngineKind(EngineKind::JIT).create());
-        if(err.length() > 0) cerr << err << endl;
+    if(auto fn = (void(*)())jit.getSymbolAddress(name))
+        fn();
+}
+
+
+/**
+ * @brief Splits mod into n partitions, compiles each partition on its own
+ * thread with its own TargetMachine, and merges the resulting objects into
+ * the single relocatable object outFile.
+ *
+ * The partitioning depends only on the contents of mod and the partitions
+ * are always written to and merged in the same order, so the output does
+ * not depend on how the threads happen to be scheduled.
+ *
+ * @return 0 on success
+ */
+int compileIRtoObjParallel(llvm::Module *mod, string const& outFile, unsigned int n){
+    vector<string> partFiles;
+    vector<unique_ptr<raw_fd_ostream>> outs;
+    vector<raw_pwrite_stream*> outPtrs;
+
+    for(unsigned int i = 0; i < n; i++){
+        std::error_code errCode;
+        partFiles.push_back(outFile + "." + to_string(i) + ".o");
+        outs.emplace_back(new raw_fd_ostream(partFiles.back(), errCode, sys::fs::OpenFlags::F_None));
+
+        if(errCode){
+            cerr << "Error when compiling to object: " << errCode.message() << endl;
+            return 1;
+        }
+        outPtrs.push_back(outs.back().get());
     }
 
-    compileIRtoObj(module.get(), (".tmp_" + f->getName()).str());
-    jit->addModule(move(module));
-    jit->finalizeObject();
-    remove((".tmp_" + f->getName()).str().c_str());
+    //the target must be initialized before any threads are started
+    auto *target = CodegenCtxt::get().target;
 
-    auto* fn = jit->getPointerToFunction(f);
+    //splitCodeGen consumes the module it is given, so give it a copy
+#if LLVM_VERSION_MAJOR >= 7
+    auto modCopy = CloneModule(*mod);
+#else
+    auto modCopy = CloneModule(mod);
+#endif
+
+    splitCodeGen(move(modCopy), outPtrs, {}, [target](){
+        return unique_ptr<TargetMachine>(createTargetMachine(target));
+    });
+
+    //flush and close each partition before linking them
+    outs.clear();
+
+    string cmd = AN_LINKER " -r -nostdlib";
+    for(auto &f : partFiles)
+        cmd += " " + f;
+    cmd += " -o " + outFile;
 
-    if(fn)
-        reinterpret_cast<void(*)()>(fn)();
+    int res = system(cmd.c_str());
+
+    for(auto &f : partFiles)
+        remove(f.c_str());
+
+    return res;
 }
 
 
 int Compiler::compileIRtoObj(llvm::Module *mod, string outFile){
-    auto *tm = getTargetMachine();
+    if(jobs > 1)
+        return compileIRtoObjParallel(mod, outFile, jobs);
+
+    auto *tm = CodegenCtxt::get().tm.get();
 
     std::error_code errCode;
     raw_fd_ostream out{outFile, errCode, sys::fs::OpenFlags::F_RW};
@@ -1926,13 +2512,12 @@ int Compiler::compileIRtoObj(llvm::Module *mod, string outFile){
 	if (out.has_error())
 		cerr << "Error when compiling to object: " << errCode << endl;
 
-    delete tm;
     return res;
 }
 
 
-int Compiler::linkObj(string inFiles, string outFile){
-    string cmd = AN_LINKER " " + inFiles + " -static -o " + outFile;
+int Compiler::linkObj(string inFiles, string outFile, bool dynamic){
+    string cmd = AN_LINKER " " + inFiles + (dynamic ? "" : " -static") + " -o " + outFile;
     return system(cmd.c_str());
 }
 
@@ -2064,6 +2649,7 @@ Value* mkPtrInt(Compiler *c, void *addr){
 
 void Compiler::stoTypeVar(string const& name, AnType *ty){
     Value *addr = builder.getInt64((unsigned long)ty);
+    markHostAddress(ty);
     TypedValue tv = TypedValue(addr, AnType::getPrimitive(TT_Type));
     Variable *var = new Variable(name, tv, scope);
     stoVar(name, var);
@@ -2078,19 +2664,11 @@ AnType* Compiler::lookupTypeVar(string const& name) const{
 
 
 AnDataType* Compiler::lookupType(string const& tyname) const{
-    auto& ut = mergedCompUnits->userTypes;
-    auto it = ut.find(tyname);
-    if(it != ut.end())
-        return it->getValue();
-    return nullptr;
+    return mergedCompUnits->getUserType(tyname);
 }
 
 Trait* Compiler::lookupTrait(string const& tyname) const{
-    auto& ts = mergedCompUnits->traits;
-    auto it = ts.find(tyname);
-    if(it != ts.end())
-        return it->getValue().get();
-    return nullptr;
+    return mergedCompUnits->getTrait(tyname);
 }
 
 
@@ -2176,7 +2754,7 @@ Compiler::Compiler(const char *_fileName, bool lib, shared_ptr<LLVMContext> llvm
         isJIT(false),
         fileName(_fileName? _fileName : "(stdin)"),
         funcPrefix(""),
-        scope(0), optLvl(2), fnScope(1){
+        scope(0), optLvl(2), sizeLvl(0), fnScope(1), jobs(1), lto(LtoMode::None), dynamicLink(false), dumpLayouts(false), remarks(false){
 
     //The lexer stores the fileName in the loc field of all Nodes. The fileName is copied
     //to let Node's outlive the Compiler they were made in, ensuring they work with imports.
@@ -2244,7 +2822,7 @@ Compiler::Compiler(Compiler *c, Node *root, string modName, bool lib) :
         fileName(c->fileName),
         outFile(modName),
         funcPrefix(""),
-        scope(0), optLvl(2), fnScope(1){
+        scope(0), optLvl(2), sizeLvl(0), fnScope(1), jobs(1), lto(LtoMode::None), dynamicLink(false), dumpLayouts(false), remarks(false){
 
     allMergedCompUnits.emplace_back(mergedCompUnits);
     allCompiledModules.try_emplace(fileName, compUnit);
@@ -2262,7 +2840,7 @@ Compiler::Compiler(Compiler *c, Node *root, string modName, bool lib) :
 }
 
 
-void Compiler::processArgs(CompilerArgs *args){
+int Compiler::processArgs(CompilerArgs *args){
     string out = "";
     bool shouldGenerateExecutable = true;
 
@@ -2276,7 +2854,31 @@ void Compiler::processArgs(CompilerArgs *args){
         else if(arg->arg == "1") optLvl = 1;
         else if(arg->arg == "2") optLvl = 2;
         else if(arg->arg == "3") optLvl = 3;
-        else{ cerr << "Unrecognized OptLvl " << arg->arg << endl; return; }
+        else if(arg->arg == "s"){ optLvl = 2; sizeLvl = 1; }
+        else if(arg->arg == "z"){ optLvl = 2; sizeLvl = 2; }
+        else{ cerr << "Unrecognized OptLvl " << arg->arg << endl; return 1; }
+    }
+
+    if(args->hasArg(Args::Dynamic)) dynamicLink = true;
+    if(args->hasArg(Args::DumpLayout)) dumpLayouts = true;
+    if(args->hasArg(Args::Remarks)) remarks = true;
+
+    if(args->hasArg(Args::LtoThin)) lto = LtoMode::Thin;
+    else if(args->hasArg(Args::Lto)) lto = LtoMode::Full;
+
+    //bitcode inputs are merged into the program rather than compiled
+    for(auto &input : args->inputFiles){
+        if(isBitcodeFile(input)){
+            ltoInputs.push_back(input);
+            if(lto == LtoMode::None)
+                lto = LtoMode::Full;
+        }
+    }
+
+    if(auto *arg = args->getArg(Args::Jobs)){
+        int n = atoi(arg->arg.c_str());
+        if(n > 0) jobs = n;
+        else{ cerr << "Invalid number of jobs " << arg->arg << endl; return 1; }
     }
 
 
@@ -2292,6 +2894,12 @@ void Compiler::processArgs(CompilerArgs *args){
                     compFn(fd.get());
             }
         }
+
+        //compile skips optimizing libraries since their functions are only
+        //compiled above.  This also inlines the always-inline shims left by
+        //lowerAggregateAbi so they do not stay in the object.
+        if(!errFlag)
+            optimizeModule(module.get(), optLvl, sizeLvl, lto, lto != LtoMode::None);
     }
 
     if(args->hasArg(Args::Check)){
@@ -2312,17 +2920,30 @@ void Compiler::processArgs(CompilerArgs *args){
         shouldGenerateExecutable = false;
     }
 
-    if(args->hasArg(Args::CompileAndRun))
+    if(args->hasArg(Args::CompileAndRun)){
+        //Without -o there is no executable to keep, so run the program in memory
+        if(out.empty())
+            return runJit(args->programArgs);
         shouldGenerateExecutable = true;
+    }
 
     if(shouldGenerateExecutable){
         compileNative();
 
         if(!errFlag && args->hasArg(Args::CompileAndRun)){
-            int res = system((AN_EXEC_STR + outFile).c_str());
-            if(res) return; //silence unused return result warning
+            string cmd = AN_EXEC_STR + outFile;
+            for(auto &arg : args->programArgs)
+                cmd += " " + quoteShellArg(arg);
+
+            int res = system(cmd.c_str());
+#ifdef WEXITSTATUS
+            return WIFEXITED(res) ? WEXITSTATUS(res) : 1;
+#else
+            return res;
+#endif
         }
     }
+    return 0;
 }
 
 Compiler::~Compiler(){
@@ -0,0 +1,127 @@
+/*
+ *      escape.cpp
+ * Moves heap allocations that do not outlive their
+ * function onto the stack.
+ */
+#include "escape.h"
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+
+using namespace std;
+using namespace llvm;
+
+namespace ante {
+
+bool isCallTo(Value *v, StringRef name){
+    auto *call = dyn_cast<CallInst>(v);
+    if(!call) return false;
+
+    auto *callee = call->getCalledFunction();
+    return callee and callee->getName() == name;
+}
+
+/*
+ * Returns true if the local variable slot is only ever loaded from
+ * besides its single initializing store, so every load yields the
+ * stored pointer and the slot's own address never escapes.
+ */
+bool isPlainSlot(AllocaInst *slot){
+    unsigned stores = 0;
+    for(auto *user : slot->users()){
+        if(isa<LoadInst>(user)) continue;
+
+        auto *si = dyn_cast<StoreInst>(user);
+        if(!si or si->getValueOperand() == slot or ++stores > 1) return false;
+    }
+    return true;
+}
+
+/*
+ * Follows every value derived from the pointer returned by malloc.
+ * Returns true if any of them escape, otherwise fills frees with
+ * each call to free on the allocation.
+ */
+bool escapes(CallInst *heapAlloc, bool inLoop, vector<CallInst*> &frees){
+    SmallVector<Value*, 8> worklist{heapAlloc};
+    SmallPtrSet<Value*, 8> visited;
+
+    while(!worklist.empty()){
+        Value *ptr = worklist.pop_back_val();
+        if(!visited.insert(ptr).second) continue;
+
+        for(auto *user : ptr->users()){
+            if(isa<BitCastInst>(user) or isa<GetElementPtrInst>(user)){
+                worklist.push_back(user);
+            }else if(isa<LoadInst>(user) or isa<ICmpInst>(user)){
+                continue;
+            }else if(auto *si = dyn_cast<StoreInst>(user)){
+                if(si->getPointerOperand() == ptr and si->getValueOperand() != ptr)
+                    continue;
+
+                //the pointer itself is stored, which is only fine for a local variable
+                auto *slot = dyn_cast<AllocaInst>(si->getPointerOperand());
+                if(inLoop or !slot or !isPlainSlot(slot))
+                    return true;
+
+                for(auto *slotUser : slot->users())
+                    if(isa<LoadInst>(slotUser))
+                        worklist.push_back(slotUser);
+            }else if(isCallTo(user, "free")){
+                frees.push_back(cast<CallInst>(user));
+            }else{
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+unsigned promoteHeapAllocations(Function *f){
+    if(f->isDeclaration()) return 0;
+
+    vector<CallInst*> mallocs;
+    for(auto &bb : *f)
+        for(auto &inst : bb)
+            if(isCallTo(&inst, "malloc"))
+                mallocs.push_back(cast<CallInst>(&inst));
+
+    if(mallocs.empty()) return 0;
+
+    DominatorTree dt{*f};
+    LoopInfo loops{dt};
+
+    IRBuilder<> b{&f->getEntryBlock(), f->getEntryBlock().begin()};
+    unsigned promoted = 0;
+
+    for(auto *heapAlloc : mallocs){
+        auto *size = dyn_cast<ConstantInt>(heapAlloc->getArgOperand(0));
+        if(!size or size->getZExtValue() > AN_MAX_STACK_PROMOTION)
+            continue;
+
+        vector<CallInst*> frees;
+        if(escapes(heapAlloc, loops.getLoopFor(heapAlloc->getParent()), frees))
+            continue;
+
+        //malloc guarantees alignment suitable for any type, so keep that guarantee
+        auto *alloca = b.CreateAlloca(ArrayType::get(b.getInt8Ty(), size->getZExtValue()));
+#if LLVM_VERSION_MAJOR >= 10
+        alloca->setAlignment(Align(16));
+#else
+        alloca->setAlignment(16);
+#endif
+        auto *cast = b.CreatePointerCast(alloca, heapAlloc->getType());
+        heapAlloc->replaceAllUsesWith(cast);
+        heapAlloc->eraseFromParent();
+
+        for(auto *free : frees)
+            free->eraseFromParent();
+
+        promoted++;
+    }
+    return promoted;
+}
+
+}
@@ -1,6 +1,8 @@
 #include "function.h"
 #include "argtuple.h"
 #include "jitlinker.h"
+#include "codegen.h"
+#include "repl.h"
 
 using namespace std;
 using namespace llvm;
@@ -168,6 +170,132 @@ AnType* validateReturns(Compiler *c, FuncDecl *fd, TypeNode *retTy = 0){
 }
 
 
+/*
+ * Returns true if values of type t are too large to be passed or
+ * returned efficiently as first-class aggregates.  Anything wider
+ * than two pointers would be split across the stack by the backend
+ * anyway, so it is cheaper to hand out an address directly.
+ */
+bool passIndirectly(Type *t){
+    if(!t->isStructTy() and !t->isArrayTy()) return false;
+    if(!t->isSized()) return false;
+
+    auto &dl = CodegenCtxt::get().dl;
+    return dl.getTypeAllocSize(t) > 2 * dl.getPointerSize();
+}
+
+/*
+ * Lowers f to a size-aware calling convention if it takes or returns
+ * large aggregates.  The body is moved into an internal function which
+ * returns through an sret pointer and takes large parameters by readonly
+ * pointer.  f itself becomes an always-inline shim with the original
+ * signature, so every existing call site, declaration in another module,
+ * and use of f as a function value stays valid.  Once the shim is inlined
+ * the temporaries it allocates are forwarded into the caller's own storage.
+ *
+ * The function containing the body is recorded in fd->impl if it was moved.
+ */
+void lowerAggregateAbi(Compiler *c, FuncDecl *fd, Function *f){
+    if(c->isJIT or f->isDeclaration() or f->isVarArg() or f->getName() == "main")
+        return;
+
+    FunctionType *ft = f->getFunctionType();
+    Type *retTy = ft->getReturnType();
+    bool sret = passIndirectly(retTy);
+
+    vector<Type*> paramTys;
+    vector<bool> byRef;
+    if(sret) paramTys.push_back(retTy->getPointerTo());
+
+    for(Type *paramTy : ft->params()){
+        bool indirect = passIndirectly(paramTy);
+        paramTys.push_back(indirect ? paramTy->getPointerTo() : paramTy);
+        byRef.push_back(indirect);
+    }
+
+    if(!sret and find(byRef.begin(), byRef.end(), true) == byRef.end())
+        return;
+
+    auto *implTy = FunctionType::get(sret ? Type::getVoidTy(*c->ctxt) : retTy, paramTys, false);
+    Function *impl = Function::Create(implTy, Function::InternalLinkage, f->getName() + ".impl", f->getParent());
+    impl->addFnAttr(Attribute::AttrKind::NoUnwind);
+    impl->getBasicBlockList().splice(impl->begin(), f->getBasicBlockList());
+
+    auto implArg = impl->arg_begin();
+    llvm::Argument *sretArg = nullptr;
+    if(sret){
+        sretArg = &*implArg++;
+        sretArg->setName("sret");
+        sretArg->addAttr(Attribute::AttrKind::StructRet);
+        sretArg->addAttr(Attribute::AttrKind::NoAlias);
+    }
+
+    //large parameters are loaded once at the start of the body so that the
+    //rest of it, compiled for by-value arguments, can be left as is
+    IRBuilder<> b(&impl->getEntryBlock(), impl->getEntryBlock().begin());
+    size_t i = 0;
+    for(auto &arg : f->args()){
+        llvm::Argument *newArg = &*implArg++;
+        newArg->takeName(&arg);
+
+        if(arg.hasNoCaptureAttr()) newArg->addAttr(Attribute::AttrKind::NoCapture);
+        if(arg.onlyReadsMemory()) newArg->addAttr(Attribute::AttrKind::ReadOnly);
+
+        if(byRef[i++]){
+            newArg->addAttr(Attribute::AttrKind::NoCapture);
+            newArg->addAttr(Attribute::AttrKind::ReadOnly);
+            Value *addr = newArg;
+            arg.replaceAllUsesWith(b.CreateLoad(addr));
+        }else{
+            arg.replaceAllUsesWith(newArg);
+        }
+    }
+
+    if(sret){
+        for(auto &bb : *impl){
+            if(auto *ri = dyn_cast<ReturnInst>(bb.getTerminator())){
+                new StoreInst(ri->getReturnValue(), sretArg, ri);
+                ReturnInst::Create(*c->ctxt, ri);
+                ri->eraseFromParent();
+            }
+        }
+    }
+
+    //rebuild f as a shim forwarding to the lowered body
+    BasicBlock *entry = BasicBlock::Create(*c->ctxt, "entry", f);
+    b.SetInsertPoint(entry);
+
+    vector<Value*> args;
+    Value *retAddr = nullptr;
+    if(sret){
+        retAddr = b.CreateAlloca(retTy);
+        args.push_back(retAddr);
+    }
+
+    i = 0;
+    for(auto &arg : f->args()){
+        if(byRef[i++]){
+            auto *tmp = b.CreateAlloca(arg.getType());
+            b.CreateStore(&arg, tmp);
+            args.push_back(tmp);
+        }else{
+            args.push_back(&arg);
+        }
+    }
+
+    auto *call = b.CreateCall(impl, args);
+    if(sret)
+        b.CreateRet(b.CreateLoad(retAddr));
+    else if(retTy->isVoidTy())
+        b.CreateRetVoid();
+    else
+        b.CreateRet(call);
+
+    f->addFnAttr(Attribute::AttrKind::AlwaysInline);
+    fd->impl = impl;
+}
+
+
 LOC_TY getFinalLoc(Node *n){
     auto *bop = dynamic_cast<BinOpNode*>(n);
 
@@ -227,10 +355,10 @@ TypedValue Compiler::compLetBindingFn(FuncDecl *fd, vector<Type*> &paramTys){
                 fd->type->extTys[i]
                 : toAnType(this, paramTyNode);
 
-        //If we are JIT compiling this function we want the args to be perfectly forwarded.
-        //They must be passed directly to work with certain compiler-api functions.  For example,
-        //it is important that Ante.store does not store a llvm::Argument
-        TypedValue tArg = isJIT ?
+        //Type values given to a function evaluated at compile-time are forwarded into its body
+        //since only the compiler knows of them.  Every other argument is passed when the function
+        //is called so it is compiled once for each signature, see compileAndCallAnteFunction.
+        TypedValue tArg = isJIT and i < ctCtxt->args.size() and ctCtxt->args[i].type->typeTag == TT_Type ?
             ctCtxt->args[i] : TypedValue(&arg, paramTy);
 
         stoVar(cParam->name, new Variable(cParam->name, tArg, this->scope,
@@ -242,6 +370,9 @@ TypedValue Compiler::compLetBindingFn(FuncDecl *fd, vector<Type*> &paramTys){
         ++i;
     }
 
+    //functions called by the function being evaluated are not given its type values
+    if(isJIT) ctCtxt->args.clear();
+
     //store a fake function var, in case this function is recursive
     auto *fakeFnTy = AnFunctionType::get(AnType::getVoid(), paramAnTys);
     auto fakeFnTv = TypedValue(preFn, fakeFnTy);
@@ -291,6 +422,7 @@ TypedValue Compiler::compLetBindingFn(FuncDecl *fd, vector<Type*> &paramTys){
     //preFn->replaceAllUsesWith(f);
     //preFn->removeFromParent();
     preFn->eraseFromParent();
+    lowerAggregateAbi(this, fd, f);
 
     TypedValue ret = {f, newFnTyn};
 
@@ -312,6 +444,53 @@ vector<llvm::Argument*> buildArguments(FunctionType *ft){
 }
 
 
+/*
+ * Applies the ![inline], ![noinline], ![cold], or ![hot] directive to f.
+ * If lowerAggregateAbi moved f's body into another function, f is only
+ * an always-inline shim so the directive is applied to the body instead.
+ */
+void applyInliningDirective(Compiler *c, FuncDecl *fd, Function *f, string const& directive){
+    Function *body = fd->impl ? fd->impl : f;
+
+    if(directive == "inline"){
+        f->addFnAttr(Attribute::AttrKind::AlwaysInline);
+        body->addFnAttr(Attribute::AttrKind::AlwaysInline);
+        c->inlineFns.emplace_back(body);
+    }else if(directive == "noinline"){
+        body->addFnAttr(Attribute::AttrKind::NoInline);
+    }else if(directive == "cold"){
+        body->addFnAttr(Attribute::AttrKind::Cold);
+    }else{
+        body->addFnAttr(Attribute::AttrKind::InlineHint);
+#if LLVM_VERSION_MAJOR >= 12
+        body->addFnAttr(Attribute::AttrKind::Hot);
+#endif
+    }
+}
+
+
+/*
+ * Returns true if values of the given type may contain an address.  Results of
+ * ![pure] functions are kept as raw bytes, so any address in them would point
+ * into memory of the call that made them.
+ */
+bool containsPointer(AnType *t){
+    if(t->typeTag == TT_Ptr or t->typeTag == TT_Function or t->typeTag == TT_MetaFunction)
+        return true;
+
+    if(auto *arr = dyn_cast<AnArrayType>(t))
+        return containsPointer(arr->extTy);
+
+    //the fields of data types, elements of tuples, and variants of unions
+    if(t->typeTag == TT_Data or t->typeTag == TT_TaggedUnion or t->typeTag == TT_Tuple){
+        for(auto *ext : static_cast<AnAggregateType*>(t)->extTys)
+            if(containsPointer(ext))
+                return true;
+    }
+    return false;
+}
+
+
 /*
  *  Handles the modifiers or compiler directives (eg. ![inline]) then
  *  compiles the function fdn with either compFn or compLetBindingFn.
@@ -326,10 +505,10 @@ TypedValue compFnWithModifiers(Compiler *c, FuncDecl *fd, ModNode *ppn){
     TypedValue fn;
     if(ppn->isCompilerDirective()){
         if(VarNode *vn = dynamic_cast<VarNode*>(ppn->expr.get())){
-            if(vn->name == "inline"){
+            if(vn->name == "inline" or vn->name == "noinline" or vn->name == "cold" or vn->name == "hot"){
                 fn = c->compFn(fd);
                 if(!fn) return fn;
-                ((Function*)fn.val)->addFnAttr(Attribute::AttrKind::AlwaysInline);
+                applyInliningDirective(c, fd, (Function*)fn.val, vn->name);
             }else if(vn->name == "run"){
                 fn = c->compFn(fd);
                 if(!fn) return fn;
@@ -341,10 +520,23 @@ TypedValue compFnWithModifiers(Compiler *c, FuncDecl *fd, ModNode *ppn){
 
                 c->jitFunction((Function*)recomp.val);
                 c->module.reset(mod);
+            }else if(vn->name == "pure" or vn->name == "memo"){
+                //results are memoized when the function is called, see compileAndCallAnteFunction
+                fn = c->compFn(fd);
+                if(fn and containsPointer(fn.type->getFunctionReturnType())){
+                    fdn->modifiers = mod_cpy;
+                    return c->compErr("![" + vn->name + "] functions cannot return a value containing a pointer, but "
+                            + fdn->name + " returns " + anTypeToColoredStr(fn.type->getFunctionReturnType()), vn->loc);
+                }
             }else if(vn->name == "on_fn_decl"){
-                auto *rettn = (TypeNode*)fdn->type.get();
-                auto *fnty = AnFunctionType::get(c, toAnType(c, rettn), fdn->params.get(), true);
-                fn = TypedValue(nullptr, fnty);
+                //hooks are only given a body when compiled to be run at compile-time
+                if(c->isJIT){
+                    fn = c->compFn(fd);
+                }else{
+                    auto *rettn = (TypeNode*)fdn->type.get();
+                    auto *fnty = AnFunctionType::get(c, toAnType(c, rettn), fdn->params.get(), true);
+                    fn = TypedValue(nullptr, fnty);
+                }
             }else{
                 return c->compErr("Unrecognized compiler directive '"+vn->name+"'", vn->loc);
             }
@@ -460,10 +652,10 @@ TypedValue compFnHelper(Compiler *c, FuncDecl *fd){
                     fd->type->extTys[i]
                     : toAnType(c, paramTyNode);
 
-            //If we are JIT compiling this function we want the args to be perfectly forwarded.
-            //They must be passed directly to work with certain compiler-api functions.  For example,
-            //it is important that Ante.store does not store a llvm::Argument
-            TypedValue tArg = c->isJIT ?
+            //Type values given to a function evaluated at compile-time are forwarded into its body
+            //since only the compiler knows of them.  Every other argument is passed when the function
+            //is called so it is compiled once for each signature, see compileAndCallAnteFunction.
+            TypedValue tArg = c->isJIT and i < c->ctCtxt->args.size() and c->ctCtxt->args[i].type->typeTag == TT_Type ?
                 c->ctCtxt->args[i] : TypedValue(&arg, paramTy);
 
             c->stoVar(cParam->name, new Variable(cParam->name, tArg, c->scope,
@@ -472,6 +664,9 @@ TypedValue compFnHelper(Compiler *c, FuncDecl *fd){
             i++;
         }
 
+        //functions called by the function being evaluated are not given its type values
+        if(c->isJIT) c->ctCtxt->args.clear();
+
         //actually compile the function, and hold onto the last value
         TypedValue v;
         try{
@@ -500,6 +695,8 @@ TypedValue compFnHelper(Compiler *c, FuncDecl *fd){
             c->builder.SetInsertPoint(caller);
             return {};
         }
+
+        lowerAggregateAbi(c, fd, f);
     }
 
     c->builder.SetInsertPoint(caller);
@@ -515,6 +712,37 @@ FuncDecl* shallow_copy(FuncDecl* fd, string &mangledName){
 }
 
 
+/*
+ * Gives a generic instantiation linkonce_odr linkage in a COMDAT keyed on
+ * its mangled name so the copies emitted by each module using it are folded
+ * into one by the linker.  The function lowerAggregateAbi moved the body
+ * into, if any, joins the same COMDAT so it is discarded along with f.
+ *
+ * The mangled name is first qualified with the module defining the generic
+ * function so same-named generics from different modules are never folded.
+ */
+void setInstantiationLinkage(Compiler *c, FuncDecl *fd, Function *f){
+    if(c->isJIT or f->isDeclaration()) return;
+
+    string qualified = fd->module->name + "." + f->getName().str();
+    f->setName(qualified);
+    if(fd->impl)
+        fd->impl->setName(qualified + ".impl");
+
+    f->setLinkage(GlobalValue::LinkOnceODRLinkage);
+
+    //MachO has no COMDATs, though its linker still folds linkonce_odr definitions
+    if(!CodegenCtxt::get().tm->getTargetTriple().supportsCOMDAT()) return;
+
+    auto *mod = f->getParent();
+    Comdat *comdat = mod->getOrInsertComdat(f->getName());
+    f->setComdat(comdat);
+
+    if(fd->impl)
+        fd->impl->setComdat(comdat);
+}
+
+
 TypedValue compTemplateFn(Compiler *c, FuncDecl *fd, TypeCheckResult &tc, vector<AnType*> &args){
     //test if bound variant is already compiled
     string mangled = mangle(fd, args);
@@ -548,7 +776,10 @@ TypedValue compTemplateFn(Compiler *c, FuncDecl *fd, TypeCheckResult &tc, vector
 
     //compile the function normally (each typevar should now be
     //substituted with its checked type from the typecheck tc)
-    return c->compFn(fd);
+    auto fn = c->compFn(fd);
+    if(fn and fn.val)
+        setInstantiationLinkage(c, fd, cast<Function>(fn.val));
+    return fn;
 }
 
 //Defined in compiler.cpp
@@ -658,7 +889,7 @@ FuncDecl* Compiler::getCurrentFunction() const{
 
 
 void Compiler::updateFn(TypedValue &f, FuncDecl *fd, string &name, string &mangledName){
-    auto &list = mergedCompUnits->fnDecls[name];
+    auto &list = mergedCompUnits->getFnDecls(name);
     auto *vec_fd = getFuncDeclFromVec(list, mangledName);
     if(vec_fd){
         vec_fd->tv = f;
@@ -666,6 +897,7 @@ void Compiler::updateFn(TypedValue &f, FuncDecl *fd, string &name, string &mangl
         fd->tv = f;
         list.push_back(shared_ptr<FuncDecl>(fd));
     }
+    replCompiledFn(this, vec_fd ? vec_fd : fd);
 }
 
 
@@ -818,7 +1050,7 @@ TypedValue Compiler::getMangledFn(string name, vector<AnType*> &args){
 
 
 vector<shared_ptr<FuncDecl>>& Compiler::getFunctionList(string const& name) const{
-    return mergedCompUnits->fnDecls[name];
+    return mergedCompUnits->getFnDecls(name);
 }
 
 
@@ -895,7 +1127,7 @@ void Compiler::registerFunction(FuncDeclNode *fn, string &mangledName){
     //check for redeclaration
     auto *redecl = getFuncDecl(fn->name, mangledName);
 
-    if(redecl and redecl->mangledName == mangledName){
+    if(redecl and redecl->mangledName == mangledName and !replRedefinition(this, redecl)){
         compErr("Function " + fn->name + " was redefined", fn->loc);
         return;
     }
@@ -905,12 +1137,9 @@ void Compiler::registerFunction(FuncDeclNode *fn, string &mangledName){
     shared_ptr<FuncDecl> fd{fdRaw};
     fd->obj = compCtxt->obj;
 
-    for(auto &hook : ctCtxt->on_fn_decl_hook){
-        Value *fd_val = builder.getInt64((unsigned long)fdRaw);
-        vector<TypedValue> args;
-        args.emplace_back(fd_val, AnDataType::get("FuncDecl"));
-        compMetaFunctionResult(this, hook->fdn->loc, hook->getName(), hook->mangledName, args);
-    }
+    //queued before checking fd's own modifiers so a hook is not given its own declaration
+    if(!ctCtxt->on_fn_decl_hook.empty())
+        ctCtxt->pendingFnDecls.emplace_back(fd, ctCtxt->on_fn_decl_hook.size());
 
     for(auto *mod : *fn->modifiers){
         auto *m = (ModNode*)mod;
@@ -922,8 +1151,26 @@ void Compiler::registerFunction(FuncDeclNode *fn, string &mangledName){
         }
     }
 
-    compUnit->fnDecls[fn->name].push_back(fd);
-    mergedCompUnits->fnDecls[fn->name].push_back(fd);
+    compUnit->getFnDecls(fn->name).push_back(fd);
+    mergedCompUnits->getFnDecls(fn->name).push_back(fd);
+    replDeclaration(this, fdRaw);
+
+    if(!ctCtxt->batchFnDecls)
+        runFnDeclHooks();
+}
+
+
+void Compiler::runFnDeclHooks(){
+    if(ctCtxt->pendingFnDecls.empty()) return;
+
+    //hooks may declare functions themselves, which are queued separately
+    vector<pair<shared_ptr<FuncDecl>, size_t>> pending;
+    pending.swap(ctCtxt->pendingFnDecls);
+
+    for(auto &decl : pending){
+        for(size_t i = 0; i < decl.second; i++)
+            callFnDeclHook(this, ctCtxt->on_fn_decl_hook[i].get(), decl.first.get());
+    }
 }
 
 } //end of namespace ante
@@ -1,4 +1,14 @@
 #include "jit.h"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/ADT/DenseSet.h>
 #include <iostream>
 
 using namespace std;
@@ -7,7 +17,192 @@ using namespace llvm::orc;
 
 namespace ante {
 
+    /** @brief Optimization levels of code before and after it is tiered up */
+    const unsigned tier0OptLevel = 0;
+    const unsigned tier1OptLevel = 3;
+
+    /** @brief Called by the unoptimized code of each JIT through the symbols below
+     * once a function is called jitTierUpThreshold times */
+    extern "C" void ante_jit_tier_up(JIT *jit, uint64_t sourceId, const char *name){
+        jit->tierUp(sourceId, name);
+    }
+
+    const char *tierUpFnName = "ante_jit_tier_up";
+    const char *sessionName = "ante_jit_session";
+
+    /** @brief Each address given to markHostAddress */
+    DenseSet<uint64_t> hostAddresses;
+
+    void markHostAddress(const void *addr){
+        hostAddresses.insert((uint64_t)addr);
+    }
+
+    /** @brief Returns true if c is or contains a non-null integer constant converted
+     * to a pointer or an integer constant given to markHostAddress */
+    bool isHostPointer(const Constant *c){
+        //globals are checked separately, and may refer to themselves
+        if(isa<GlobalValue>(c)) return false;
+
+        if(auto *ci = dyn_cast<ConstantInt>(c))
+            return ci->getBitWidth() == 64 and hostAddresses.count(ci->getZExtValue());
+
+        auto *ce = dyn_cast<ConstantExpr>(c);
+        if(ce and ce->getOpcode() == Instruction::IntToPtr)
+            if(auto *addr = dyn_cast<ConstantInt>(ce->getOperand(0)))
+                return !addr->isZero();
+
+        for(auto &op : c->operands())
+            if(isa<Constant>(op) and isHostPointer(cast<Constant>(op)))
+                return true;
+        return false;
+    }
+
+    /** @brief Returns true if any instruction or initializer of m refers to a host pointer */
+    bool containsHostPointers(const Module *m){
+        for(auto &g : m->globals())
+            if(g.hasInitializer() and isHostPointer(g.getInitializer()))
+                return true;
+
+        for(auto &f : *m)
+            for(auto &bb : f)
+                for(auto &inst : bb)
+                    for(auto &op : inst.operands())
+                        if(isa<Constant>(op) and isHostPointer(cast<Constant>(op)))
+                            return true;
+        return false;
+    }
+
+    string DiskObjectCache::getCachePath(const Module *m) const{
+        if(containsHostPointers(m))
+            return "";
+
+        string ir;
+        raw_string_ostream os{ir};
+        m->print(os, nullptr);
+        os.flush();
+
+        MD5 hash;
+        hash.update(ir);
+        hash.update(tm.getTargetTriple().str());
+        hash.update(tm.getTargetCPU());
+        hash.update(tm.getTargetFeatureString());
+        hash.update(getTargetCpuIdent());
+        hash.update(to_string(tm.getOptLevel()));
+
+        MD5::MD5Result result;
+        hash.final(result);
+        SmallString<32> key;
+        MD5::stringifyResult(result, key);
+
+        SmallString<128> path{dir};
+        sys::path::append(path, key.str() + ".o");
+        return path.str().str();
+    }
+
+    void DiskObjectCache::notifyObjectCompiled(const Module *m, MemoryBufferRef obj){
+        misses++;
+        if(sys::fs::create_directories(dir)){
+            missedModule = nullptr;
+            return;
+        }
+
+        string path = m == missedModule ? missedPath : getCachePath(m);
+        missedModule = nullptr;
+        if(path.empty())
+            return;
+
+        //Write to a unique file first so other compilers never read a partially written object
+        SmallString<128> tmpPath;
+        int fd;
+        if(sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, tmpPath))
+            return;
+
+        {
+            raw_fd_ostream out{fd, true};
+            out << obj.getBuffer();
+        }
+
+        if(sys::fs::rename(tmpPath, path))
+            sys::fs::remove(tmpPath);
+    }
+
+    unique_ptr<MemoryBuffer> DiskObjectCache::getObject(const Module *m){
+        string path = getCachePath(m);
+        if(path.empty()){
+            missedModule = m;
+            missedPath = path;
+            return nullptr;
+        }
+
+        auto buf = MemoryBuffer::getFile(path);
+        if(!buf){
+            missedModule = m;
+            missedPath = path;
+            return nullptr;
+        }
+
+        missedModule = nullptr;
+        hits++;
+        return move(*buf);
+    }
+
+
+    /** @brief Records optLvl in m so the object cache does not mix up
+     * code optimized at different levels */
+    void setJitOptLevel(Module &m, unsigned optLvl){
+        if(!m.getModuleFlag("ante.jit.opt"))
+            m.addModuleFlag(Module::Warning, "ante.jit.opt", optLvl);
+    }
+
+
+    unique_ptr<Module> cloneModule(const Module &m){
+#if LLVM_VERSION_MAJOR >= 7
+        return CloneModule(m);
+#else
+        return CloneModule(&m);
+#endif
+    }
+
+    /**
+     * @brief Gives each local function and mutable global of m external linkage under
+     * a name unique to the module with the given id.
+     *
+     * CompileOnDemandLayer would otherwise rename them, leaving tierUp unable to find
+     * the stubs of m's functions or the globals its optimized copies share with m.
+     */
+    void exposeLocals(Module &m, uint64_t id){
+        string suffix = ".src" + to_string(id);
+
+        for(auto &f : m){
+            if(f.isDeclaration() or !f.hasLocalLinkage()) continue;
+            string name = (f.getName() + suffix).str();
+            f.setName(name);
+            f.setLinkage(GlobalValue::ExternalLinkage);
+        }
+
+        for(auto &g : m.globals()){
+            if(g.isDeclaration() or g.isConstant() or !g.hasLocalLinkage()) continue;
+            string name = (g.getName() + suffix).str();
+            g.setName(name);
+            g.setLinkage(GlobalValue::ExternalLinkage);
+        }
+    }
+
     JIT::ModuleHandle JIT::addModule(std::unique_ptr<Module> m){
+        shared_ptr<TierUpSource> source;
+        if(jitTierUpThreshold > 0){
+            uint64_t id = tierUpSources.size();
+            exposeLocals(*m, id);
+
+            source = make_shared<TierUpSource>();
+            source->mod = cloneModule(*m);
+            tierUpSources.push_back(source);
+            addTierUpCounters(m.get(), id);
+        }
+
+        string tierUpFn = mangle(tierUpFnName);
+        string session = mangle(sessionName);
+
         auto symResolver = createLambdaResolver(
             //Look back into the JIT itself to find symbols part of the same dylib
             [&](const string &name){
@@ -16,6 +211,35 @@ namespace ante {
                 return JITSymbol(nullptr);
             },
             //search for external symbols in the host process
+            [this, tierUpFn, session](const string &name){
+                if(name == tierUpFn)
+                    return JITSymbol((JITTargetAddress)&ante_jit_tier_up, JITSymbolFlags::Exported);
+                if(name == session)
+                    return JITSymbol((JITTargetAddress)this, JITSymbolFlags::Exported);
+                if(auto symAddr = RTDyldMemoryManager::getSymbolAddressInProcess(name))
+                    return JITSymbol(symAddr, JITSymbolFlags::Exported);
+                return JITSymbol(nullptr);
+            }
+        );
+
+        auto handle = cantFail(codLayer.addModule(move(m), move(symResolver)));
+
+        if(source){
+            source->handle = handle;
+            source->stubs = lastStubsManager;
+        }
+        return handle;
+    }
+
+    JIT::EagerModuleHandle JIT::addModuleEagerly(std::unique_ptr<Module> m, unsigned optLvl){
+        setJitOptLevel(*m, optLvl);
+
+        auto symResolver = createLambdaResolver(
+            [this](const string &name){
+                if(auto sym = compileLayer.findSymbol(name, false))
+                    return sym;
+                return JITSymbol(nullptr);
+            },
             [](const string &name){
                 if(auto symAddr = RTDyldMemoryManager::getSymbolAddressInProcess(name))
                     return JITSymbol(symAddr, JITSymbolFlags::Exported);
@@ -23,29 +247,174 @@ namespace ante {
             }
         );
 
-        return cantFail(codLayer.addModule(move(m), move(symResolver)));
+        return cantFail(compileLayer.addModule(move(m), move(symResolver)));
+    }
+
+    void JIT::addTierUpCounters(Module *m, uint64_t sourceId){
+        auto &ctxt = m->getContext();
+        auto *i64 = Type::getInt64Ty(ctxt);
+        auto *i8ptr = Type::getInt8PtrTy(ctxt);
+
+        //Both resolve to host addresses in addModule
+        auto *session = new GlobalVariable(*m, Type::getInt8Ty(ctxt), false,
+                GlobalValue::ExternalLinkage, nullptr, sessionName);
+
+        auto *tierUpTy = FunctionType::get(Type::getVoidTy(ctxt), {i8ptr, i64, i8ptr}, false);
+        auto *tierUpFn = Function::Create(tierUpTy, GlobalValue::ExternalLinkage, tierUpFnName, m);
+
+        vector<Function*> fns;
+        for(auto &f : *m)
+            if(!f.isDeclaration())
+                fns.push_back(&f);
+
+        IRBuilder<> b{ctxt};
+        for(auto *f : fns){
+            auto *counter = new GlobalVariable(*m, i64, false, GlobalValue::InternalLinkage,
+                    ConstantInt::get(i64, 0), f->getName() + ".calls");
+
+            //Count calls after the allocas so they stay in the entry block
+            BasicBlock &entry = f->getEntryBlock();
+            auto it = entry.begin();
+            while(isa<AllocaInst>(*it)) ++it;
+
+            BasicBlock *body = entry.splitBasicBlock(it, "body");
+            BasicBlock *promote = BasicBlock::Create(ctxt, "tierup", f, body);
+            entry.getTerminator()->eraseFromParent();
+
+            b.SetInsertPoint(&entry);
+            auto *calls = b.CreateAdd(b.CreateLoad(i64, counter), ConstantInt::get(i64, 1));
+            b.CreateStore(calls, counter);
+            auto *isHot = b.CreateICmpEQ(calls, ConstantInt::get(i64, jitTierUpThreshold));
+            b.CreateCondBr(isHot, promote, body);
+
+            b.SetInsertPoint(promote);
+            auto *name = b.CreateGlobalStringPtr(f->getName());
+            b.CreateCall(tierUpFn, {session, ConstantInt::get(i64, sourceId), name});
+            b.CreateBr(body);
+        }
+    }
+
+    /** @brief Runs the standard optimization pipeline of the given level on m */
+    void runOptimizations(Module &m, unsigned optLvl){
+        PassManagerBuilder pmb;
+        pmb.OptLevel = optLvl;
+        pmb.Inliner = createFunctionInliningPass(optLvl, 0, false);
+
+        legacy::FunctionPassManager fpm{&m};
+        legacy::PassManager mpm;
+        pmb.populateFunctionPassManager(fpm);
+        pmb.populateModulePassManager(mpm);
+
+        fpm.doInitialization();
+        for(auto &f : m)
+            fpm.run(f);
+        fpm.doFinalization();
+
+        mpm.run(m);
     }
 
     std::shared_ptr<Module> JIT::optimizeModule(std::shared_ptr<Module> m){
-        auto fpm = llvm::make_unique<legacy::FunctionPassManager>(m.get());
+        //With tiering enabled, code runs unoptimized until it is called enough to tier up
+        if(jitTierUpThreshold > 0){
+            setJitOptLevel(*m, tier0OptLevel);
+        }else{
+            runOptimizations(*m, tier1OptLevel);
+            setJitOptLevel(*m, tier1OptLevel);
+        }
+        return m;
+    }
+
+    void JIT::tierUp(uint64_t sourceId, StringRef name){
+        if(sourceId >= tierUpSources.size()) return;
 
-        fpm->add(createInstructionCombiningPass());
-        fpm->add(createReassociatePass());
-        fpm->add(createGVNPass());
-        fpm->add(createCFGSimplificationPass());
-        fpm->doInitialization();
+        auto source = tierUpSources[sourceId];
+        if(!source) return;
+
+        //Copy the whole module so the function's callees can be inlined.  The
+        //copies of other functions are internal and each non-constant global
+        //refers back to the original so state is shared with the unoptimized code.
+        auto m = cloneModule(*source->mod);
+        string optName = (name + ".tier1").str();
 
         for(auto &f : *m){
-            fpm->run(f);
+            if(f.isDeclaration()) continue;
+            f.setComdat(nullptr);
+            f.setLinkage(GlobalValue::InternalLinkage);
         }
-        return m;
+
+        for(auto &g : m->globals()){
+            if(g.isDeclaration()) continue;
+            g.setComdat(nullptr);
+            if(g.isConstant()){
+                g.setLinkage(GlobalValue::InternalLinkage);
+            }else{
+                g.setInitializer(nullptr);
+                g.setLinkage(GlobalValue::ExternalLinkage);
+            }
+        }
+
+        auto *f = m->getFunction(name);
+        f->setName(optName);
+        f->setLinkage(GlobalValue::ExternalLinkage);
+
+        runOptimizations(*m, tier1OptLevel);
+        setJitOptLevel(*m, tier1OptLevel);
+
+        auto symResolver = createLambdaResolver(
+            //Prefer the original module's globals over any others of the same name
+            [this, source](const string &sym){
+                if(auto s = codLayer.findSymbolIn(source->handle, sym, false))
+                    return s;
+                if(auto s = codLayer.findSymbol(sym, false))
+                    return s;
+                return JITSymbol(nullptr);
+            },
+            [](const string &sym){
+                if(auto symAddr = RTDyldMemoryManager::getSymbolAddressInProcess(sym))
+                    return JITSymbol(symAddr, JITSymbolFlags::Exported);
+                return JITSymbol(nullptr);
+            }
+        );
+
+        auto handle = cantFail(compileLayer.addModule(move(m), move(symResolver)));
+        auto addr = cantFail(compileLayer.findSymbolIn(handle, mangle(optName), false).getAddress());
+
+        //Stubs are a single pointer, so each call sees either the old or new version
+        cantFail(source->stubs->updatePointer(mangle(name), addr));
+        tierUps++;
     }
 
-    JITSymbol JIT::findSymbol(const string name){
+    string JIT::getUniqueName(StringRef prefix, StringRef key){
+        MD5 hash;
+        hash.update(key);
+        MD5::MD5Result result;
+        hash.final(result);
+        SmallString<32> hex;
+        MD5::stringifyResult(result, hex);
+
+        string base = (prefix + "." + hex.str()).str();
+        string name = base;
+        for(size_t i = 1; usedNames.count(name); i++)
+            name = base + "." + to_string(i);
+
+        usedNames.insert(name);
+        return name;
+    }
+
+    string JIT::mangle(StringRef name) const{
         string mangledName;
         raw_string_ostream mangledNameStream(mangledName);
         Mangler::getNameWithPrefix(mangledNameStream, name, dl);
-        return codLayer.findSymbol(mangledNameStream.str(), true);
+        return mangledNameStream.str();
+    }
+
+    JITSymbol JIT::findSymbol(const string name){
+        string mangledName = mangle(name);
+        if(auto sym = codLayer.findSymbol(mangledName, true))
+            return sym;
+
+        //Modules added with addModuleEagerly skip codLayer
+        return compileLayer.findSymbol(mangledName, true);
     }
 
     JITTargetAddress JIT::getSymbolAddress(const string name){
@@ -53,9 +422,19 @@ namespace ante {
     }
 
     void JIT::removeModule(ModuleHandle h){
+        //Sources are indexed by id, so removed ones only leave a hole
+        for(auto &source : tierUpSources)
+            if(source and source->handle == h)
+                source = nullptr;
         cantFail(codLayer.removeModule(h));
     }
 
+    JIT& JIT::getSession(){
+        //Never freed as the code it holds may be called until the compiler exits
+        static JIT *session = new JIT();
+        return *session;
+    }
+
     void JIT::handleUnrecognizedFn(){
         cerr << "JIT Error: Unrecognized function called, aborting!" << endl;
     }
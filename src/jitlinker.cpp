@@ -14,64 +14,34 @@ using namespace ante::parser;
 namespace ante {
 
 /*
- * Returns a new module containing shallow copies of the given module's
- * traits. Copies the FuncDecls and UserTypes one level deeper so that
- * when the FuncDecl is marked as compiled the change is not performed
- * across every Compiler instance that imported the function.
+ * Returns a new module viewing the declarations of mod.  Nothing is copied
+ * up front; the FuncDecls of each name are copied into the view when first
+ * used so that marking them as compiled is not performed across every
+ * Compiler instance that imported the function.
  */
-ante::Module* copyModuleFuncDecls(const ante::Module *mod){
+ante::Module* createModuleView(ante::Module *mod){
     auto ret = new ante::Module();
     ret->name = mod->name;
-    ret->traits = mod->traits;
-
-    //copy each userType except for the LLVMContext-specific llvmTypes field
-    for(auto &pair : mod->userTypes){
-        auto dt = pair.second;
-    //    auto dt_cpy = make_shared<AnDataType>(dt->name, dt->fields, dt);
-    //    dt_cpy->traitImpls = dt->traitImpls;
-    //    dt_cpy->tags = dt->tags;
-    //    dt_cpy->generics = dt->generics;
-    //    dt_cpy->llvmType = dt->llvmType;
-        ret->userTypes[pair.first()] = dt;
-    }
-
-    for(auto &pair : mod->fnDecls){
-        for(auto &fd : pair.second){
-            auto fd_cpy = make_shared<FuncDecl>(fd->fdn, fd->mangledName, fd->scope, ret);
-            fd_cpy->obj = fd->obj;
-            fd_cpy->obj_bindings = fd->obj_bindings;
-            ret->fnDecls[pair.first()].push_back(fd_cpy);
-        }
-    }
-
+    ret->parent = mod;
     return ret;
 }
 
 vector<ante::Module*>
-copyModuleFuncDecls(const vector<ante::Module*> &mods){
+createModuleViews(const vector<ante::Module*> &mods){
     vector<ante::Module*> ret;
+    ret.reserve(mods.size());
     for(auto &m : mods){
-        ret.push_back(copyModuleFuncDecls(m));
-    }
-    return ret;
-}
-
-
-llvm::StringMap<ante::Module*>
-copyModuleFuncDecls(const llvm::StringMap<ante::Module*> &varTable){
-    auto ret = llvm::StringMap<ante::Module*>();
-    for(auto &pair : varTable){
-        ret[pair.first()] = copyModuleFuncDecls(pair.second);
+        ret.push_back(createModuleView(m));
     }
     return ret;
 }
 
-void copyDecls(const Compiler *src, Compiler *dest){
+void copyDecls(Compiler *src, Compiler *dest){
     //dest->ctxt = src->ctxt;
 
-    dest->compUnit = copyModuleFuncDecls(src->compUnit);
-    dest->mergedCompUnits = copyModuleFuncDecls(src->mergedCompUnits);
-    dest->imports = copyModuleFuncDecls(src->imports);
+    dest->compUnit = createModuleView(src->compUnit);
+    dest->mergedCompUnits = createModuleView(src->mergedCompUnits);
+    dest->imports = createModuleViews(src->imports);
 }
 
 /*
@@ -169,14 +139,12 @@ void copyGlobals(Compiler *c, Compiler *ccpy){
 
 
 /*
- * Copies a function into a new module (named after the function)
- * and copies any functions that are needed by the copied function
- * into the new module as well.
+ * Creates a Compiler for a new module with access to every declaration
+ * visible to c, in which the function being evaluated is compiled with
+ * the type values in ctCtxt->args forwarded into its body.
  */
-unique_ptr<Compiler> wrapFnInModule(Compiler *c, string const& baseName,
-        string const& mangledName, vector<TypedValue> const& args){
-
-    unique_ptr<Compiler> ccpy{new Compiler(c, c->ast.get(), mangledName)};
+unique_ptr<Compiler> createJitCompiler(Compiler *c, string const& modName){
+    unique_ptr<Compiler> ccpy{new Compiler(c, c->ast.get(), modName)};
     ccpy->isJIT = true;
 
     copyDecls(c, ccpy.get());
@@ -188,7 +156,19 @@ unique_ptr<Compiler> wrapFnInModule(Compiler *c, string const& baseName,
     ccpy->createMainFn();
     //the ret comes separate
     ccpy->builder.CreateRet(ConstantInt::get(*ccpy->ctxt, APInt(32, 1)));
+    return ccpy;
+}
+
+
+/*
+ * Copies a function into a new module (named after the function)
+ * and copies any functions that are needed by the copied function
+ * into the new module as well.
+ */
+unique_ptr<Compiler> wrapFnInModule(Compiler *c, string const& baseName,
+        string const& mangledName, vector<TypedValue> const& args){
 
+    auto ccpy = createJitCompiler(c, mangledName);
     ccpy->ctCtxt->args = args;
 
     auto *fn = ccpy->getFuncDecl(baseName, mangledName);
@@ -196,7 +176,13 @@ unique_ptr<Compiler> wrapFnInModule(Compiler *c, string const& baseName,
 
     if(fn){
         auto argTys = toTypeVector(args);
-        compFnWithArgs(ccpy.get(), fn, argTys);
+        try{
+            compFnWithArgs(ccpy.get(), fn, argTys);
+        }catch(...){
+            //ccpy's ast wraps c's, so it must not be freed with it
+            ccpy->ast.release();
+            throw;
+        }
     }else if(ccpy->getFunction(baseName, baseName)){
         return ccpy;
     }else{
@@ -0,0 +1,124 @@
+/*
+ *      linker.cpp
+ * Links executables within the current process using lld
+ * when ante is built with AN_USE_LLD.
+ */
+#include "linker.h"
+#include "target.h"
+
+#ifdef AN_USE_LLD
+#include <lld/Driver/Driver.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/Triple.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#endif
+
+using namespace std;
+using namespace llvm;
+
+//Directories of the C runtime startup files and of libgcc, normally set by the Makefile
+#ifndef AN_CRT_DIR
+#  define AN_CRT_DIR "/usr/lib/"
+#endif
+
+#ifndef AN_GCC_LIB_DIR
+#  define AN_GCC_LIB_DIR "/usr/lib/"
+#endif
+
+namespace ante {
+
+#if defined(AN_USE_LLD) && defined(__linux__)
+
+bool canLinkInProcess(){
+    return true;
+}
+
+/**
+ * @brief Copies obj into an anonymous in-memory file
+ *
+ * @return The file descriptor of the file, or -1 on failure
+ */
+int createMemoryFile(ArrayRef<char> obj){
+    int fd = syscall(SYS_memfd_create, "ante-obj", 0);
+    if(fd < 0) return -1;
+
+    size_t written = 0;
+    while(written < obj.size()){
+        ssize_t n = write(fd, obj.data() + written, obj.size() - written);
+        if(n <= 0){
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+    return fd;
+}
+
+
+/**
+ * @brief Returns the path of the glibc dynamic linker of the native target,
+ * or nullptr if it is not known.  AN_DYNAMIC_LINKER overrides it if set.
+ */
+const char* getDynamicLinker(){
+#ifdef AN_DYNAMIC_LINKER
+    return AN_DYNAMIC_LINKER;
+#else
+    switch(Triple(AN_NATIVE_ARCH, AN_NATIVE_VENDOR, AN_NATIVE_OS).getArch()){
+        case Triple::x86_64:  return "/lib64/ld-linux-x86-64.so.2";
+        case Triple::x86:     return "/lib/ld-linux.so.2";
+        case Triple::aarch64: return "/lib/ld-linux-aarch64.so.1";
+        case Triple::ppc64le: return "/lib64/ld64.so.2";
+        default:              return nullptr;
+    }
+#endif
+}
+
+
+int linkInProcess(ArrayRef<char> obj, string const& outFile, bool dynamic){
+    //Let the system linker pick the dynamic linker of targets we do not know
+    const char *dynamicLinker = getDynamicLinker();
+    if(dynamic and !dynamicLinker)
+        return -1;
+
+    int fd = createMemoryFile(obj);
+    if(fd < 0) return -1;
+
+    //lld only accepts file names so refer to the in-memory file through /proc
+    string objPath = "/proc/self/fd/" + to_string(fd);
+
+    vector<const char*> args = {"ld.lld", "-o", outFile.c_str()};
+
+    if(dynamic){
+        args.insert(args.end(), {"-dynamic-linker", dynamicLinker,
+            AN_CRT_DIR "crt1.o", AN_CRT_DIR "crti.o", AN_GCC_LIB_DIR "crtbegin.o",
+            objPath.c_str(), "-L" AN_GCC_LIB_DIR, "-L" AN_CRT_DIR,
+            "-lc", "-lgcc", "--as-needed", "-lgcc_s", "--no-as-needed",
+            AN_GCC_LIB_DIR "crtend.o", AN_CRT_DIR "crtn.o"});
+    }else{
+        args.insert(args.end(), {"-static",
+            AN_CRT_DIR "crt1.o", AN_CRT_DIR "crti.o", AN_GCC_LIB_DIR "crtbeginT.o",
+            objPath.c_str(), "-L" AN_GCC_LIB_DIR, "-L" AN_CRT_DIR,
+            "--start-group", "-lgcc", "-lgcc_eh", "-lc", "--end-group",
+            AN_GCC_LIB_DIR "crtend.o", AN_CRT_DIR "crtn.o"});
+    }
+
+    bool success = lld::elf::link(args, false, errs());
+    close(fd);
+    return success ? 0 : 1;
+}
+
+#else
+
+bool canLinkInProcess(){
+    return false;
+}
+
+int linkInProcess(ArrayRef<char> obj, string const& outFile, bool dynamic){
+    return -1;
+}
+
+#endif
+
+}
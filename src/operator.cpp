@@ -1,5 +1,6 @@
 #include <llvm/ExecutionEngine/Interpreter.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/IPO/Internalize.h>
 #include "compiler.h"
 #include "types.h"
 #include "function.h"
@@ -250,33 +251,40 @@ TypedValue Compiler::compInsert(BinOpNode *op, Node *assignExpr){
 }
 
 
-TypedValue createUnionVariantCast(Compiler *c, TypedValue &valToCast, string &tagName, AnDataType *dataTy, TypeCheckResult &tyeq){
-    auto *unionDataTy = dataTy->parentUnionType;
+TypedValue createUnionValue(Compiler *c, AnDataType *unionTy, size_t tagVal, Value *variant){
+    auto layout = getUnionLayout(c, unionTy, unionTy->isGeneric);
+    Type *unionLlvmTy = c->anTypeToLlvmType(unionTy, unionTy->isGeneric);
 
-    if(tyeq->res == TypeCheckResult::SuccessWithTypeVars){
-        unionDataTy = (AnDataType*)bindGenericToType(c, unionDataTy, tyeq->bindings);
-    }
+    if(layout.kind == UnionLayout::Enum){
+        return TypedValue(ConstantInt::get(unionLlvmTy, tagVal), unionTy);
 
-    Type *variantTy = c->anTypeToLlvmType(valToCast.type);
+    }else if(layout.kind == UnionLayout::NullNiche){
+        if(variant)
+            return TypedValue(c->builder.CreatePointerCast(variant, unionLlvmTy), unionTy);
 
-    auto tagVal = unionDataTy->getTagVal(tagName);
+        return TypedValue(ConstantPointerNull::get(cast<PointerType>(unionLlvmTy)), unionTy);
+    }
+
+    Type *tagTy = Type::getIntNTy(*c->ctxt, layout.tagBits);
 
     vector<Type*> unionTys;
-    unionTys.push_back(Type::getInt8Ty(*c->ctxt));
-    unionTys.push_back(variantTy);
+    unionTys.push_back(tagTy);
 
     vector<Constant*> unionVals;
-    unionVals.push_back(ConstantInt::get(*c->ctxt, APInt(8, tagVal, true))); //tag
-    unionVals.push_back(UndefValue::get(variantTy));
+    unionVals.push_back(ConstantInt::get(tagTy, tagVal));
 
-    Type *unionTy = c->anTypeToLlvmType(unionDataTy);
+    if(variant){
+        unionTys.push_back(variant->getType());
+        unionVals.push_back(UndefValue::get(variant->getType()));
+    }
 
-    //create a struct of (u8 tag, <union member type>)
-    auto *uninitUnion = ConstantStruct::get(StructType::get(*c->ctxt, unionTys, true), unionVals);
-    auto* taggedUnion = c->builder.CreateInsertValue(uninitUnion, valToCast.val, 1);
+    //create a struct of (tag, <union member type>)
+    Value *taggedUnion = ConstantStruct::get(StructType::get(*c->ctxt, unionTys, true), unionVals);
+    if(variant)
+        taggedUnion = c->builder.CreateInsertValue(taggedUnion, variant, 1);
 
     //allocate for the largest possible union member
-    auto *alloca = c->builder.CreateAlloca(unionTy);
+    auto *alloca = c->createEntryBlockAlloca(unionLlvmTy);
 
     //but bitcast it the the current member
     auto *castTo = c->builder.CreateBitCast(alloca, taggedUnion->getType()->getPointerTo());
@@ -285,7 +293,19 @@ TypedValue createUnionVariantCast(Compiler *c, TypedValue &valToCast, string &ta
     //load the original alloca, not the bitcasted one
     Value *unionVal = c->builder.CreateLoad(alloca);
 
-    return TypedValue(unionVal, unionDataTy);
+    return TypedValue(unionVal, unionTy);
+}
+
+
+TypedValue createUnionVariantCast(Compiler *c, TypedValue &valToCast, string &tagName, AnDataType *dataTy, TypeCheckResult &tyeq){
+    auto *unionDataTy = dataTy->parentUnionType;
+
+    if(tyeq->res == TypeCheckResult::SuccessWithTypeVars){
+        unionDataTy = (AnDataType*)bindGenericToType(c, unionDataTy, tyeq->bindings);
+    }
+
+    auto tagVal = unionDataTy->getTagVal(tagName);
+    return createUnionValue(c, unionDataTy, tagVal, valToCast.val);
 }
 
 
@@ -371,10 +391,12 @@ TypedValue reinterpretTuple(Compiler *c, Value *from, AnType *to){
         return TypedValue(rstruct, to);
     }
 
-    auto nElems = rstruct->getType()->getStructNumElements();
+    //the fields of to may be reordered, the tuple's are always in declaration order
+    auto *dataTy = dyn_cast<AnDataType>(to);
+    auto nElems = from->getType()->getStructNumElements();
     for(size_t i = 0; i < nElems; i++){
         auto *elem = c->builder.CreateExtractValue(from, i);
-        rstruct = c->builder.CreateInsertValue(rstruct, elem, i);
+        rstruct = c->builder.CreateInsertValue(rstruct, elem, dataTy ? dataTy->getLlvmFieldIndex(i) : i);
     }
 
     return TypedValue(rstruct, to);
@@ -387,6 +409,16 @@ TypedValue doReinterpretCast(Compiler *c, AnType *castTy, TypedValue &valToCast,
         return {};
 
     }else if(rcr.type == ReinterpretCastResult::ValToPrimitive){
+        //put the fields of a reordered data type back in declaration order
+        auto *valDt = dyn_cast<AnDataType>(valToCast.type);
+        if(valDt and !valDt->fieldIndices.empty() and castTy->typeTag == TT_Tuple){
+            Value *tup = UndefValue::get(c->anTypeToLlvmType(castTy));
+            for(unsigned i = 0; i < valDt->fieldIndices.size(); i++){
+                auto *elem = c->builder.CreateExtractValue(valToCast.val, valDt->fieldIndices[i]);
+                tup = c->builder.CreateInsertValue(tup, elem, i);
+            }
+            return TypedValue(tup, castTy);
+        }
         return TypedValue(valToCast.val, castTy);
 
     }else{ //ValToUnion or ValToStruct
@@ -448,15 +480,6 @@ TypedValue createCast(Compiler *c, AnType *castTy, TypedValue &valToCast, LOC_TY
                 return doReinterpretCast(c, castTy, valToCast, castResult);
         }
 
-        if(c->isJIT){
-            auto *fnty = AnFunctionType::get(c, AnType::getVoid(), fd->fdn->params.get());
-            if(fnty->extTys.size() == 1 and c->typeEq(fnty->extTys[0], valToCast.type)){
-                string baseName = getCastFnBaseName(castTy);
-                string mangledName = mangle(baseName, {valToCast.type});
-                return compileAndCallAnteFunction(c, baseName, mangledName, {valToCast});
-            }
-        }
-
         //Compile the function now that we know to use it over a cast
         auto fn = c->getCastFn(valToCast.type, castTy, fd);
         if(fn){
@@ -796,7 +819,7 @@ TypedValue Compiler::compMemberAccess(Node *ln, VarNode *field, BinOpNode *binop
                 if(index == 0 and !val->getType()->isStructTy())
                     return TypedValue(val, retTy);
 
-                auto ev = builder.CreateExtractValue(val, index);
+                auto ev = builder.CreateExtractValue(val, dataTy->getLlvmFieldIndex(index));
                 auto ret = TypedValue(ev, retTy);
                 return ret;
             }
@@ -885,9 +908,6 @@ void* lookupCFn(string name){
 
 
 TypedValue createMallocAndStore(Compiler *c, TypedValue &val){
-    string mallocFnName = "malloc";
-    Function* mallocFn = (Function*)c->getFunction(mallocFnName, mallocFnName).val;
-
     auto size_result = val.type->getSizeInBits(c);
     if(!size_result){
         cerr << size_result.getErr() << endl;
@@ -895,9 +915,25 @@ TypedValue createMallocAndStore(Compiler *c, TypedValue &val){
     }
     auto size = size_result.getVal() / 8;
 
+    //types over-aligned with ![align N] are padded to a multiple of their alignment
+    //as aligned_alloc requires, but their size in bits does not include the padding
+    unsigned align = getExplicitAlignment(val.getType());
+    if(align > AN_MALLOC_ALIGNMENT)
+        size = CodegenCtxt::get().dl.getTypeAllocSize(val.getType());
+
     Value *sizeVal = ConstantInt::get(*c->ctxt, APInt(AN_USZ_SIZE, size, true));
 
-    Value *voidPtr = c->builder.CreateCall(mallocFn, sizeVal);
+    Value *voidPtr;
+    if(align > AN_MALLOC_ALIGNMENT){
+        auto *usz = c->builder.getIntNTy(AN_USZ_SIZE);
+        auto *fnTy = FunctionType::get(c->builder.getInt8PtrTy(), {usz, usz}, false);
+        auto alignedAlloc = c->module->getOrInsertFunction("aligned_alloc", fnTy);
+        voidPtr = c->builder.CreateCall(alignedAlloc, {ConstantInt::get(usz, align), sizeVal});
+    }else{
+        string mallocFnName = "malloc";
+        Function* mallocFn = (Function*)c->getFunction(mallocFnName, mallocFnName).val;
+        voidPtr = c->builder.CreateCall(mallocFn, sizeVal);
+    }
     Type *ptrTy = val.getType()->getPointerTo();
     Value *typedPtr = c->builder.CreatePointerCast(voidPtr, ptrTy);
 
@@ -910,69 +946,222 @@ TypedValue createMallocAndStore(Compiler *c, TypedValue &val){
 
 
 /*
- * Unwrap the single i8* argument given to AnteCall into a vector of each value the
- * function it should call requires.
+ * Unpack the arguments AnteCall is given in its first i8* parameter into a vector of
+ * each value the function it should call requires.  The arguments are laid out as
+ * an unpacked struct of their types, the same layout ArgTuple stores them in.
  */
-vector<Value*> unwrapVoidPtrArgs(Compiler *c, Value *anteCallArg, vector<TypedValue> const& typedArgs, FuncDecl *fd){
+vector<Value*> unpackDriverArgs(Compiler *c, Value *anteCallArg, vector<TypedValue> const& typedArgs, FuncDecl *fd){
     vector<Value*> ret;
     bool varargs = cast<Function>(fd->tv.val)->isVarArg();
 
     auto *fnTy = cast<Function>(fd->tv.val)->getFunctionType();
     if(fnTy->getNumParams() == 0 and !varargs) return ret;
 
+    vector<Type*> paramTys;
     size_t argc = fnTy->getNumParams();
-    for(size_t i = 0; i < argc or (varargs and i < typedArgs.size()); i++){
-        llvm::Type *castTy = varargs ?
-            typedArgs[i].getType()->getPointerTo() :
-            fnTy->getParamType(i)->getPointerTo();
+    for(size_t i = 0; i < argc or (varargs and i < typedArgs.size()); i++)
+        paramTys.push_back(i < argc ? fnTy->getParamType(i) : typedArgs[i].getType());
 
-        Value *cast = c->builder.CreateBitCast(anteCallArg, castTy);
-        ret.push_back(c->builder.CreateLoad(cast));
+    auto *tupleTy = StructType::get(*c->ctxt, paramTys);
+    Value *tuple = c->builder.CreateBitCast(anteCallArg, tupleTy->getPointerTo());
 
-        if(i != argc - 1 or (varargs and i != typedArgs.size() - 1))
-            anteCallArg = c->builder.CreateInBoundsGEP(cast, c->builder.getInt64(1));
+    for(unsigned i = 0; i < paramTys.size(); i++){
+        Value *field = c->builder.CreateStructGEP(tupleTy, tuple, i);
+        ret.push_back(c->builder.CreateLoad(paramTys[i], field));
     }
-
     return ret;
 }
 
 
 /**
- * Creates a function AnteCall that unpacks the given arguments from a void*,
- * and returns the result of a call to the given FuncDecl with those arguments.
+ * Creates a function AnteCall that unpacks the given arguments from its first
+ * parameter and stores the result of a call to the given FuncDecl with those
+ * arguments into its second.
  *
- * AnteCall has the type 't*->'u* where 't is a tuple of fd's parameter types (to
- * be unpacked within AnteCall) and 'u is the return type of fd.
+ * AnteCall has the type 't* -> 'u* -> void where 't is a tuple of fd's parameter
+ * types and 'u is the return type of fd.  Both are provided by the caller, so
+ * no memory is allocated to call the function.
  */
-void createDriverFunction(Compiler *c, FuncDecl *fd, vector<TypedValue> const& typedArgs){
+void createDriverFunction(Compiler *c, FuncDecl *fd, vector<TypedValue> const& typedArgs, string const& name){
     Type *voidPtrTy = Type::getInt8Ty(*c->ctxt)->getPointerTo();
-    FunctionType *fnTy = FunctionType::get(voidPtrTy, voidPtrTy, false);
+    FunctionType *fnTy = FunctionType::get(Type::getVoidTy(*c->ctxt), {voidPtrTy, voidPtrTy}, false);
 
-    //preFn is the predecessor to fn because we do not yet know its return type, so its body must be compiled,
-    //then the type must be checked and the new function with correct return type created, and their bodies swapped.
-    Function *fn = Function::Create(fnTy, Function::ExternalLinkage, "AnteCall", c->module.get());
+    Function *fn = Function::Create(fnTy, Function::ExternalLinkage, name, c->module.get());
     BasicBlock *entry = BasicBlock::Create(*c->ctxt, "entry", fn);
     c->builder.SetInsertPoint(entry);
 
-    auto *fnArg1 = fn->arg_begin();
-    auto args = unwrapVoidPtrArgs(c, fnArg1, typedArgs, fd);
+    auto argIt = fn->arg_begin();
+    Value *argsPtr = &*argIt++;
+    Value *retPtr = &*argIt;
+    auto args = unpackDriverArgs(c, argsPtr, typedArgs, fd);
 
     Value *call = c->builder.CreateCall(fd->tv.val, args);
     AnType *retTy = fd->tv.type->getFunctionReturnType();
-    if(retTy->typeTag == TT_Void){
-        c->builder.CreateRetVoid();
-    }else{
-        auto callTv = TypedValue(call, fd->tv.type->getFunctionReturnType());
+    if(retTy->typeTag != TT_Void){
+        Value *typedRetPtr = c->builder.CreateBitCast(retPtr, call->getType()->getPointerTo());
+        c->builder.CreateStore(call, typedRetPtr);
+    }
+    c->builder.CreateRetVoid();
+}
+
+/*
+ * A compile-time function compiled into the JIT session, callable through
+ * its AnteCall driver.
+ */
+struct CompiledMetaFn {
+    void (*driver)(void*, void*);
+    AnType *retTy;
+
+    /* False if compiling the function called a compiler-api function, whose
+     * effects a later call reusing the compiled function would skip */
+    bool cacheable;
+};
 
-        auto store = createMallocAndStore(c, callTv);
-        auto ret = c->builder.CreateBitCast(store.val, voidPtrTy);
-        c->builder.CreateRet(ret);
+/*
+ * Compile-time functions compiled so far, keyed by getMetaFnCacheKey.
+ */
+llvm::StringMap<CompiledMetaFn> metaFnCache;
+size_t metaFnCompilations = 0;
+size_t metaFnCacheHits = 0;
+
+/*
+ * The number of calls to compiler-api functions which have effects on, or read
+ * the state of, the compiler rather than depending only on the types of their
+ * arguments.  See isTypeOnlyCompApiFn.
+ */
+size_t compApiEffects = 0;
+
+/*
+ * The result of a call to a ![pure] or ![memo] compile-time function.  The
+ * result is kept as the bytes the function returned rather than as a TypedValue
+ * so it can be converted into constants of whichever module later makes the call.
+ */
+struct MemoizedResult {
+    vector<char> bytes;
+    AnType *retTy;
+};
+
+/*
+ * Results of pure compile-time calls made so far, keyed by getMemoKey.
+ */
+llvm::StringMap<MemoizedResult> memoizedResults;
+size_t memoHits = 0;
+
+/*
+ * Calls an on_fn_decl hook with the address of the FuncDecl it is given.
+ */
+using FnDeclHookDriver = void(*)(void*);
+
+/*
+ * The driver of each on_fn_decl hook compiled so far, keyed by the hook's declaration.
+ */
+DenseMap<FuncDecl*, FnDeclHookDriver> fnDeclHooks;
+
+
+/*
+ * Returns true if fd has the ![pure] or ![memo] directive, in which case
+ * calls to it with the same constant arguments are only evaluated once.
+ * Other compile-time functions are called again for each call.
+ */
+bool isMemoized(FuncDecl *fd){
+    if(!fd->fdn->modifiers) return false;
+
+    for(auto *mod : *fd->fdn->modifiers){
+        auto *m = (ModNode*)mod;
+        if(!m->isCompilerDirective()) continue;
+
+        auto *vn = dynamic_cast<VarNode*>(m->expr.get());
+        if(vn and (vn->name == "pure" or vn->name == "memo"))
+            return true;
     }
+    return false;
 }
 
-TypedValue compileAndCallAnteFunction(Compiler *c, string const& baseName,
-        string const& mangledName, vector<TypedValue> const& typedArgs){
 
+/*
+ * Prints the constant v to os in a form independent of the module it is in,
+ * printing the contents of any global constants it refers to rather than
+ * their names.  Returns false if v is not a constant.
+ */
+bool printConstantKey(raw_ostream &os, Value *v){
+    if(auto *gv = dyn_cast<GlobalVariable>(v)){
+        if(!gv->isConstant() or !gv->hasInitializer()) return false;
+        os << "global ";
+        return printConstantKey(os, gv->getInitializer());
+    }
+
+    if(isa<ConstantExpr>(v) or isa<ConstantAggregate>(v)){
+        auto *c = cast<Constant>(v);
+        if(auto *ce = dyn_cast<ConstantExpr>(c))
+            os << ce->getOpcodeName();
+
+        os << '(';
+        for(auto &op : c->operands()){
+            if(!printConstantKey(os, op)) return false;
+            os << ", ";
+        }
+        os << ')';
+        return true;
+    }
+
+    if(!isa<Constant>(v)) return false;
+    v->printAsOperand(os, true);
+    return true;
+}
+
+/*
+ * Compile-time functions are compiled once for each signature and are given
+ * their arguments when called, so the cache key contains the type of each
+ * argument.  Type values are the exception as they are forwarded into the
+ * function's body, so their values are included as well.  The name is qualified
+ * with the module declaring fd as functions in different modules may share a
+ * mangled name.
+ */
+string getMetaFnCacheKey(FuncDecl *fd, string const& mangledName, vector<TypedValue> const& typedArgs){
+    string key;
+    raw_string_ostream os{key};
+    os << fd->module->name << '\0' << mangledName;
+
+    for(auto &arg : typedArgs){
+        os << '\0' << anTypeToStr(arg.type);
+        if(arg.type->typeTag == TT_Type){
+            os << ' ';
+            printConstantKey(os, arg.val);
+        }
+    }
+
+    os.flush();
+    return key;
+}
+
+/*
+ * The memoized result of a call is keyed by the cache key of the function
+ * called along with the value of each argument.  Returns false if any
+ * argument is not a constant.
+ */
+bool getMemoKey(string const& fnKey, vector<TypedValue> const& typedArgs, string &key){
+    raw_string_ostream os{key};
+    os << fnKey;
+
+    for(auto &arg : typedArgs){
+        os << '\0';
+        if(!printConstantKey(os, arg.val)) return false;
+    }
+
+    os.flush();
+    return true;
+}
+
+
+/*
+ * Compiles the compile-time function along with a driver function to call it
+ * into the JIT session.  The driver is named after key, or after the number of
+ * functions compiled so far if the call has no cache key.
+ */
+CompiledMetaFn compileMetaFunction(Compiler *c, string const& baseName,
+        string const& mangledName, vector<TypedValue> const& typedArgs, string const& key){
+
+    size_t effects = compApiEffects;
     auto mod_compiler = wrapFnInModule(c, baseName, mangledName, typedArgs);
     mod_compiler->ast.release();
 
@@ -993,25 +1182,195 @@ TypedValue compileAndCallAnteFunction(Compiler *c, string const& baseName,
         throw new CtError();
     }
 
-    createDriverFunction(mod_compiler.get(), fd, typedArgs);
-    std::error_code ec;
+    //Each module shares one JIT session, so each driver needs a unique name and
+    //everything else is made internal to not clash with earlier modules' copies
+    auto &jit = JIT::getSession();
+    string driverName = jit.getUniqueName("AnteCall", key.empty() ? to_string(metaFnCompilations) : key);
+    metaFnCompilations++;
+    createDriverFunction(mod_compiler.get(), fd, typedArgs, driverName);
 
-    JIT* jit = new JIT();
-    jit->addModule(move(mod_compiler->module));
+    internalizeModule(*mod_compiler->module, [&](const GlobalValue &gv){
+        return gv.getName() == driverName;
+    });
 
-    auto fn = (void*(*)(void*))jit->getSymbolAddress("AnteCall");
-    if(fn){
+    jit.addModule(move(mod_compiler->module));
+
+    auto driver = (void(*)(void*, void*))jit.getSymbolAddress(driverName);
+    return {driver, fd->tv.type->getFunctionReturnType(), compApiEffects == effects};
+}
+
+
+TypedValue compileAndCallAnteFunction(Compiler *c, string const& baseName,
+        string const& mangledName, vector<TypedValue> const& typedArgs){
+
+    auto *fd = c->getFuncDecl(baseName, mangledName);
+    string key = fd ? getMetaFnCacheKey(fd, mangledName, typedArgs) : "";
+
+    string memoKey;
+    bool memoize = fd and isMemoized(fd) and getMemoKey(key, typedArgs, memoKey);
+
+    if(memoize){
+        auto memo = memoizedResults.find(memoKey);
+        if(memo != memoizedResults.end()){
+            memoHits++;
+            return ArgTuple(c, memo->second.bytes.data(), memo->second.retTy).asTypedValue();
+        }
+    }
+
+    CompiledMetaFn fn;
+    auto it = fd ? metaFnCache.find(key) : metaFnCache.end();
+
+    if(it != metaFnCache.end()){
+        fn = it->second;
+        metaFnCacheHits++;
+    }else{
+        fn = compileMetaFunction(c, baseName, mangledName, typedArgs, key);
+        if(fd and fn.driver and fn.cacheable)
+            metaFnCache[key] = fn;
+    }
+
+    if(fn.driver){
         auto arg = ArgTuple(c, typedArgs);
 
-        auto res = fn(arg.asRawData());
-        auto *retTy = fd->tv.type->getFunctionReturnType();
-        return ArgTuple(c, res, retTy).asTypedValue();
+        //The result is copied out into constants, so its buffer only needs to outlive the call
+        auto &dl = CodegenCtxt::get().dl;
+        auto *retTy = c->anTypeToLlvmType(fn.retTy);
+        size_t retSize = retTy->isSized() ? dl.getTypeAllocSize(retTy) : 0;
+        unique_ptr<char[]> res{new char[retSize ? retSize : 1]()};
+
+        fn.driver(arg.asRawData(), res.get());
+
+        if(memoize)
+            memoizedResults[memoKey] = {vector<char>(res.get(), res.get() + retSize), fn.retTy};
+
+        return ArgTuple(c, res.get(), fn.retTy).asTypedValue();
     }else{
         cerr << "(null)" << endl;
         return c->getVoidLiteral();
     }
 }
 
+
+/*
+ * Compiles the on_fn_decl hook into the JIT along with a driver taking the
+ * address of the FuncDecl to pass to it.  No arguments are forwarded into the
+ * hook, so the same compiled hook serves every declaration.
+ */
+FnDeclHookDriver compileFnDeclHook(Compiler *c, FuncDecl *hook){
+    auto &jit = JIT::getSession();
+    string driverName = jit.getUniqueName("AnteCall", hook->module->name + '\0' + hook->mangledName);
+    metaFnCompilations++;
+
+    auto mod_compiler = createJitCompiler(c, driverName);
+    auto args = c->ctCtxt->args;
+
+    Function *hookFn;
+    try{
+        FuncDecl *fd = mod_compiler->getFuncDecl(hook->getName(), hook->mangledName);
+        if(!fd){
+            c->errFlag = true;
+            cerr << "Error in compileFnDeclHook: cannot find " << hook->getName() << endl;
+            throw new CtError();
+        }
+
+        mod_compiler->ctCtxt->args.clear();
+        auto fn = compFnWithArgs(mod_compiler.get(), fd, {AnDataType::get("FuncDecl")});
+        hookFn = fn ? dyn_cast<Function>(fn.val) : nullptr;
+
+        auto *declTy = c->anTypeToLlvmType(AnDataType::get("FuncDecl"));
+        if(!hookFn or hookFn->arg_size() != 1 or hookFn->getFunctionType()->getParamType(0) != declTy)
+            c->compErr("on_fn_decl hooks must take a single FuncDecl parameter", hook->fdn->loc);
+    }catch(...){
+        //the helper's ast wraps c's, so it must not be freed with it
+        mod_compiler->ast.release();
+        c->ctCtxt->args = args;
+        throw;
+    }
+    mod_compiler->ast.release();
+    c->ctCtxt->args = args;
+
+    //FuncDecl wraps the address the driver is given
+    auto *voidPtrTy = Type::getInt8Ty(*c->ctxt)->getPointerTo();
+    auto *driverTy = FunctionType::get(Type::getVoidTy(*c->ctxt), {voidPtrTy}, false);
+    Function *driver = Function::Create(driverTy, Function::ExternalLinkage, driverName, mod_compiler->module.get());
+    auto &b = mod_compiler->builder;
+    b.SetInsertPoint(BasicBlock::Create(*c->ctxt, "entry", driver));
+
+    auto *declTy = hookFn->getFunctionType()->getParamType(0);
+    Value *decl = b.CreateInsertValue(UndefValue::get(declTy), &*driver->arg_begin(), 0);
+    b.CreateCall(hookFn, decl);
+    b.CreateRetVoid();
+
+    internalizeModule(*mod_compiler->module, [&](const GlobalValue &gv){
+        return gv.getName() == driverName;
+    });
+
+    jit.addModule(move(mod_compiler->module));
+    return (FnDeclHookDriver)jit.getSymbolAddress(driverName);
+}
+
+
+void callFnDeclHook(Compiler *c, FuncDecl *hook, FuncDecl *decl){
+    auto it = fnDeclHooks.find(hook);
+    FnDeclHookDriver driver;
+    if(it == fnDeclHooks.end()){
+        //a hook that fails to compile is only reported once
+        fnDeclHooks[hook] = nullptr;
+        driver = compileFnDeclHook(c, hook);
+        fnDeclHooks[hook] = driver;
+    }else{
+        driver = it->second;
+    }
+
+    if(driver)
+        driver(decl);
+}
+
+
+void clearMetaFunctionCache(){
+    metaFnCache.clear();
+    memoizedResults.clear();
+    fnDeclHooks.clear();
+    metaFnCacheHits = 0;
+    memoHits = 0;
+}
+
+
+void reportMetaFunctionCache(){
+    if(metaFnCompilations == 0 and metaFnCacheHits == 0 and memoHits == 0) return;
+
+    cerr << "remark: compile-time calls: " << metaFnCompilations << " compiled by the JIT, "
+         << metaFnCacheHits << " reused a cached function\n";
+
+    if(!memoizedResults.empty()){
+        cerr << "remark: pure compile-time calls: " << memoHits << " memoized, "
+             << memoizedResults.size() << " distinct results\n";
+    }
+
+    if(metaFnCompilations == 0) return;
+
+    auto &jit = JIT::getSession();
+    if(jitTierUpThreshold > 0){
+        cerr << "remark: jit tiering: " << jit.tierUps << " functions optimized after "
+             << jitTierUpThreshold << " calls\n";
+    }
+
+    if(auto *objCache = jit.getObjectCache()){
+        cerr << "remark: jit object cache: " << objCache->hits << " modules loaded from "
+             << jitCacheDir << ", " << objCache->misses << " generated\n";
+    }
+}
+
+/*
+ * Returns true if the compiler-api function only depends on the types of its
+ * arguments, so compiling a call to it can be shared by every call to the
+ * compile-time function it is in.
+ */
+bool isTypeOnlyCompApiFn(string const& name){
+    return name == "Ante_sizeof" or name == "Ante_alignof" or name == "FuncDecl_getName";
+}
+
+
 /*
  *  Compile a compile-time function/macro which should not return a function call,
  *  just a compile-time constant.
@@ -1032,6 +1391,9 @@ TypedValue compMetaFunctionResult(Compiler *c, LOC_TY const& loc, string const&
     //fn was found, this is a builtin compiler api function
     TypedValue *res;
 
+    if(!isTypeOnlyCompApiFn(baseName))
+        compApiEffects++;
+
     if(typedArgs.size() != fn->params.size())
         return c->compErr("Called function was given " + to_string(typedArgs.size()) +
                 " argument(s) but was declared to take " + to_string(fn->params.size()), loc);
@@ -1086,7 +1448,7 @@ TypedValue addrOf(Compiler *c, TypedValue &tv){
         }
     }
     //if it is not stack-allocated already, allocate it on the stack
-    auto *alloca = c->builder.CreateAlloca(tv.getType());
+    auto *alloca = c->createEntryBlockAlloca(tv.getType());
     c->builder.CreateStore(tv.val, alloca);
     return TypedValue(alloca, ptrTy);
 }
@@ -1103,19 +1465,7 @@ TypedValue tryImplicitCast(Compiler *c, TypedValue &arg, AnType *castTy){
     //check for an implicit Cast function
     TypedValue fn;
 
-    if(c->isJIT){
-        string baseName = getCastFnBaseName(castTy);
-        string mangledName = mangle(baseName, {arg.type});
-
-        //perform an unfortunate double lookup
-        //TODO: rework compileAndCallAnteFunction to accept FuncDecls
-        if(FuncDecl *fd = c->getFuncDecl(baseName, mangledName)){
-            AnFunctionType *fty = AnFunctionType::get(c, AnType::getVoid(), fd->fdn->params.get());
-            if(c->typeEq({arg.type}, fty->extTys)){
-                return compileAndCallAnteFunction(c, baseName, mangledName, {arg});
-            }
-        }
-    }else if((fn = c->getCastFn(arg.type, castTy))){
+    if((fn = c->getCastFn(arg.type, castTy))){
         AnFunctionType *fty = (AnFunctionType*)fn.type;
         if(c->typeEq({arg.type}, fty->extTys)){
             vector<Value*> args{arg.val};
@@ -1360,7 +1710,7 @@ TypedValue compFnCall(Compiler *c, Node *l, Node *r){
 
     //if tvf is a ![macro] or similar MetaFunction, then compile it in a separate
     //module and JIT it instead of creating a call instruction
-    if(c->isJIT or tvf.type->typeTag == TT_MetaFunction){
+    if(tvf.type->typeTag == TT_MetaFunction){
         string baseName = getName(l);
         auto *fnty = (AnFunctionType*)tvf.type;
         string mangledName = mangle(baseName, fnty->extTys);
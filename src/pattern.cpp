@@ -20,8 +20,13 @@ namespace ante {
         return c->builder.GetInsertBlock()->getParent();
     }
 
+    /**
+     * Match a literal pattern.
+     * @param testKnown True if the value is already known to equal the literal,
+     *        eg. because the match switched on it, so no comparison is needed.
+     */
     void match_literal(CompilingVisitor &cv, MatchNode *n, Node *pattern,
-            BasicBlock *jmpOnFail, TypedValue &valToMatch, LiteralType literalType){
+            BasicBlock *jmpOnFail, TypedValue &valToMatch, LiteralType literalType, bool testKnown = false){
 
         pattern->accept(cv);
 
@@ -31,6 +36,8 @@ namespace ante {
                     + " to corresponding value's type " + anTypeToColoredStr(valToMatch.type), pattern->loc);
         }
 
+        if(testKnown) return;
+
         Value *eq;
         if(literalType == Int){
             eq = cv.c->builder.CreateICmpEQ(cv.val.val, valToMatch.val);
@@ -102,19 +109,29 @@ namespace ante {
         return ty;
     }
 
-    Type* getUnionVariantType(Compiler *c, AnDataType *tagTy){
+    Type* getUnionVariantType(Compiler *c, AnDataType *tagTy, Type *tagValTy){
         AnType *anTagData = unionVariantToTupleTy(tagTy);
         Type *tagData = c->anTypeToLlvmType(anTagData);
         return tagData->isVoidTy() ?
-            StructType::get(*c->ctxt, {c->builder.getInt8Ty()}, true) :
-            StructType::get(*c->ctxt, {c->builder.getInt8Ty(), tagData}, true);
+            StructType::get(*c->ctxt, {tagValTy}, true) :
+            StructType::get(*c->ctxt, {tagValTy, tagData}, true);
     }
 
     TypedValue unionDowncast(Compiler *c, TypedValue valToMatch, AnDataType *tagTy){
+        //NullNiche layout, the pointer itself is the variant's data
+        if(valToMatch.getType()->isPointerTy()){
+            AnType *anTagData = unionVariantToTupleTy(tagTy);
+            if(anTagData->typeTag == TT_Void)
+                return c->getVoidLiteral();
+
+            auto *cast = c->builder.CreatePointerCast(valToMatch.val, c->anTypeToLlvmType(anTagData));
+            return {cast, anTagData};
+        }
+
         auto alloca = addrOf(c, valToMatch);
 
         //bitcast valToMatch* to (tag, tagData)*
-        auto *castTy = getUnionVariantType(c, tagTy);
+        auto *castTy = getUnionVariantType(c, tagTy, valToMatch.getType()->getStructElementType(0));
 
         if(castTy->getStructNumElements() != 1){
             auto *cast = c->builder.CreateBitCast(alloca.val, castTy->getPointerTo());
@@ -132,9 +149,11 @@ namespace ante {
      * Match a union variant pattern, eg. Some x or None
      * @param pattern The type to match against, eg. Some
      * @param bindExpr The optional expr to bind params to, eg. x
+     * @param tagKnown True if the tag was already checked, eg. because the match
+     *        switched on it, so only bindExpr needs to be matched.
      */
     void match_variant(CompilingVisitor &cv, MatchNode *n, TypeNode *pattern,
-            Node *bindExpr, BasicBlock *jmpOnFail, TypedValue &valToMatch){
+            Node *bindExpr, BasicBlock *jmpOnFail, TypedValue &valToMatch, bool tagKnown = false){
 
         Compiler *c = cv.c;
 
@@ -148,8 +167,7 @@ namespace ante {
                     + " must be a union tag to be used in a pattern", pattern->loc);
 
         auto *parentTy = tagTy->parentUnionType;
-        ConstantInt *ci = ConstantInt::get(*c->ctxt,
-                APInt(8, parentTy->getTagVal(pattern->typeName), true));
+        size_t tag = parentTy->getTagVal(pattern->typeName);
 
         tagTy = (AnDataType*)bindGenericToType(c, tagTy, ((AnDataType*)valToMatch.type)->boundGenerics);
         tagTy = tagTy->setModifier(valToMatch.type->mods);
@@ -162,30 +180,40 @@ namespace ante {
                     " to matched value of type " + anTypeToColoredStr(valToMatch.type), pattern->loc);
 
         //Extract tag value and check for equality
-        Value *eq;
-        if(valToMatch.getType()->isStructTy()){
-            Value *tagVal = c->builder.CreateExtractValue(valToMatch.val, 0);
-            eq = c->builder.CreateICmpEQ(tagVal, ci);
-        }else if(valToMatch.getType()->isIntegerTy()){
-            eq = c->builder.CreateICmpEQ(valToMatch.val, ci);
-        }else{
-            //all tagged unions are either just their tag (enum) or a tag and value.
-            assert_unreachable();
-        }
+        if(!tagKnown){
+            Value *eq;
+            Type *unionTy = valToMatch.getType();
+            if(unionTy->isStructTy()){
+                Value *tagVal = c->builder.CreateExtractValue(valToMatch.val, 0);
+                eq = c->builder.CreateICmpEQ(tagVal, ConstantInt::get(tagVal->getType(), tag));
+            }else if(unionTy->isIntegerTy()){
+                eq = c->builder.CreateICmpEQ(valToMatch.val, ConstantInt::get(unionTy, tag));
+            }else if(unionTy->isPointerTy()){
+                //the data-less variant of a NullNiche union is null
+                auto layout = getUnionLayout(c, (AnDataType*)valToMatch.type);
+                auto *niche = ConstantPointerNull::get(cast<PointerType>(unionTy));
+
+                eq = tag == layout.nicheTag ? c->builder.CreateICmpEQ(valToMatch.val, niche)
+                                            : c->builder.CreateICmpNE(valToMatch.val, niche);
+            }else{
+                //all tagged unions are either just their tag (enum), a tag and value, or a pointer.
+                assert_unreachable();
+            }
 
-        BasicBlock *jmpOnSuccess = BasicBlock::Create(*cv.c->ctxt, "match", getCurFunction(cv.c));
-        c->builder.CreateCondBr(eq, jmpOnSuccess, jmpOnFail);
-        c->builder.SetInsertPoint(jmpOnSuccess);
+            BasicBlock *jmpOnSuccess = BasicBlock::Create(*cv.c->ctxt, "match", getCurFunction(cv.c));
+            c->builder.CreateCondBr(eq, jmpOnSuccess, jmpOnFail);
+            c->builder.SetInsertPoint(jmpOnSuccess);
+        }
 
         //bind any identifiers and match remaining pattern
         if(bindExpr){
             TypedValue variant;
-            if(valToMatch.getType()->isStructTy()){
+            if(valToMatch.getType()->isStructTy() or valToMatch.getType()->isPointerTy()){
                 variant = unionDowncast(c, valToMatch, tagTy);
             }else if(valToMatch.getType()->isIntegerTy()){
                 variant = c->getVoidLiteral();
             }else{
-                //all tagged unions are either just their tag (enum) or a tag and value.
+                //all tagged unions are either just their tag (enum), a tag and value, or a pointer.
                 assert_unreachable();
             }
             handlePattern(cv, n, bindExpr, jmpOnFail, variant);
@@ -222,43 +250,238 @@ namespace ante {
     }
 
 
+    /**
+     * The kind of value a match switches on, determined by its top-level patterns.
+     * Matches of kind None test each pattern in turn instead.
+     */
+    enum class SwitchKind {
+        None, Tag, Int, StrLen
+    };
+
+    /**
+     * Match a top-level pattern whose outermost test has already been performed
+     * by the switch of a match of the given kind.
+     */
+    void handleSwitchedPattern(CompilingVisitor &cv, MatchNode *n, Node *pattern,
+            BasicBlock *jmpOnFail, TypedValue &valToMatch, SwitchKind kind){
+
+        if(kind == SwitchKind::Tag){
+            if(TypeCastNode *tcn = dynamic_cast<TypeCastNode*>(pattern)){
+                match_variant(cv, n, tcn->typeExpr.get(), tcn->rval.get(), jmpOnFail, valToMatch, true);
+                return;
+            }else if(TypeNode *tn = dynamic_cast<TypeNode*>(pattern)){
+                match_variant(cv, n, tn, nullptr, jmpOnFail, valToMatch, true);
+                return;
+            }
+        }else if(kind == SwitchKind::Int){
+            match_literal(cv, n, pattern, jmpOnFail, valToMatch, Int, true);
+            return;
+        }
+
+        //Only the length of a string was switched on, the contents still need to be compared
+        handlePattern(cv, n, pattern, jmpOnFail, valToMatch);
+    }
+
+    /**
+     * Returns the case a top-level pattern is dispatched to by a switch of the given
+     * kind, or nullptr if the pattern cannot be dispatched to with the switch.
+     */
+    ConstantInt* getSwitchCase(CompilingVisitor &cv, Node *pattern, TypedValue &valToMatch,
+            SwitchKind kind, IntegerType *switchTy){
+
+        if(kind == SwitchKind::Tag){
+            TypeNode *tn = dynamic_cast<TypeNode*>(pattern);
+            if(TypeCastNode *tcn = dynamic_cast<TypeCastNode*>(pattern))
+                tn = tcn->typeExpr.get();
+            if(!tn) return nullptr;
+
+            auto *tagTy = AnDataType::get(tn->typeName);
+            if(!tagTy or tagTy->isStub() or !tagTy->isUnionTag())
+                return nullptr;
+
+            auto *parentTy = tagTy->parentUnionType;
+            if(!cv.c->typeEq(parentTy, valToMatch.type))
+                return nullptr;
+
+            return ConstantInt::get(switchTy, parentTy->getTagVal(tn->typeName));
+
+        }else if(kind == SwitchKind::Int){
+            if(!dynamic_cast<IntLitNode*>(pattern)) return nullptr;
+
+            auto lit = CompilingVisitor::compile(cv.c, pattern);
+            auto *ci = dyn_cast<ConstantInt>(lit.val);
+            return ci and ci->getType() == switchTy ? ci : nullptr;
+
+        }else if(kind == SwitchKind::StrLen){
+            auto *sln = dynamic_cast<StrLitNode*>(pattern);
+
+            //interpolated strings do not have a constant length
+            if(!sln or sln->val.find("${") != string::npos)
+                return nullptr;
+
+            return ConstantInt::get(switchTy, sln->val.length());
+        }
+        return nullptr;
+    }
+
+    /**
+     * Determines whether the given match can dispatch on its top-level patterns with
+     * a single switch instead of testing each pattern in turn.  If so, each branch's
+     * case is stored in cases, with nullptr for catch-all var patterns, and the value
+     * to switch on is emitted and stored in switchOn.  Otherwise cases is left empty.
+     */
+    SwitchKind getSwitchCases(CompilingVisitor &cv, MatchNode *n, TypedValue &valToMatch,
+            vector<ConstantInt*> &cases, Value *&switchOn){
+
+        Type *ty = valToMatch.getType();
+        Node *firstPattern = nullptr;
+        for(auto &mbn : n->branches){
+            if(!dynamic_cast<VarNode*>(mbn->pattern.get())){
+                firstPattern = mbn->pattern.get();
+                break;
+            }
+        }
+
+        //Tagged unions are either just their tag (enum) or a tag and value,
+        //and Strs are a c8* and usz length
+        SwitchKind kind = SwitchKind::None;
+        IntegerType *switchTy = nullptr;
+
+        if(dynamic_cast<TypeNode*>(firstPattern) or dynamic_cast<TypeCastNode*>(firstPattern)){
+            kind = SwitchKind::Tag;
+            switchTy = ty->isStructTy() ? dyn_cast<IntegerType>(ty->getStructElementType(0))
+                                        : dyn_cast<IntegerType>(ty);
+        }else if(dynamic_cast<IntLitNode*>(firstPattern)){
+            kind = SwitchKind::Int;
+            switchTy = dyn_cast<IntegerType>(ty);
+        }else if(dynamic_cast<StrLitNode*>(firstPattern)){
+            auto *dt = dyn_cast<AnDataType>(valToMatch.type);
+            if(dt and dt->name == "Str" and ty->isStructTy()){
+                kind = SwitchKind::StrLen;
+                switchTy = dyn_cast<IntegerType>(ty->getStructElementType(1));
+            }
+        }
+
+        if(!switchTy) return SwitchKind::None;
+
+        //every pattern must either be a case of the switch or a catch-all,
+        //and there must be more than one case for a switch to be worthwhile
+        size_t numCases = 0;
+        cases.clear();
+        for(auto &mbn : n->branches){
+            Node *pattern = mbn->pattern.get();
+            if(dynamic_cast<VarNode*>(pattern)){
+                cases.push_back(nullptr);
+                continue;
+            }
+
+            auto *ci = getSwitchCase(cv, pattern, valToMatch, kind, switchTy);
+            if(!ci){
+                cases.clear();
+                return SwitchKind::None;
+            }
+
+            cases.push_back(ci);
+            numCases++;
+        }
+
+        if(numCases < 2){
+            cases.clear();
+            return SwitchKind::None;
+        }
+
+        if(kind == SwitchKind::StrLen or (kind == SwitchKind::Tag and ty->isStructTy()))
+            switchOn = cv.c->builder.CreateExtractValue(valToMatch.val, kind == SwitchKind::StrLen ? 1 : 0);
+        else
+            switchOn = valToMatch.val;
+
+        return kind;
+    }
+
+
+    /**
+     * Compiles a match expression.
+     *
+     * When the top-level patterns are union tags, integer literals, or string literals
+     * (along with any catch-all var patterns), a single switch on the tag, integer, or
+     * string length dispatches to the first branch that could match.  Each branch then
+     * only checks what the switch could not (nested patterns and string contents) and
+     * on failure jumps directly to the next branch that could still match, skipping
+     * those with different cases.  Otherwise each branch's pattern is tested in turn.
+     */
     void CompilingVisitor::visit(MatchNode *n){
         n->expr->accept(*this);
         auto valToMatch = this->val;
 
         Function *f = c->builder.GetInsertBlock()->getParent();
+        size_t numBranches = n->branches.size();
 
         vector<pair<BasicBlock*,TypedValue>> merges;
-        merges.reserve(n->branches.size());
+        merges.reserve(numBranches + 1);
 
+        vector<BasicBlock*> patternBlocks;
+        for(size_t i = 0; i < numBranches; i++)
+            patternBlocks.push_back(BasicBlock::Create(*c->ctxt, "match_pattern", f));
+
+        BasicBlock *noMatch = BasicBlock::Create(*c->ctxt, "no_match", f);
         BasicBlock *endmatch = BasicBlock::Create(*c->ctxt, "end_match", f);
-        BasicBlock *finalEndPat = nullptr;
 
-        for(auto& mbn : n->branches){
-            BasicBlock *endpat = &mbn == &n->branches.back() ?
-                endmatch : BasicBlock::Create(*c->ctxt, "end_pattern", f);
+        vector<ConstantInt*> cases;
+        Value *switchOn = nullptr;
+        auto kind = getSwitchCases(*this, n, valToMatch, cases, switchOn);
+
+        //Returns the first branch at or after i that may match a value with the given case
+        auto nextCandidate = [&](size_t i, ConstantInt *caseVal){
+            for(; i < numBranches; i++)
+                if(kind == SwitchKind::None or !cases[i] or cases[i] == caseVal)
+                    return patternBlocks[i];
+            return noMatch;
+        };
+
+        if(kind == SwitchKind::None){
+            c->builder.CreateBr(nextCandidate(0, nullptr));
+        }else{
+            auto *sw = c->builder.CreateSwitch(switchOn, nextCandidate(0, nullptr), numBranches);
+            SmallPtrSet<ConstantInt*, 8> added;
+            for(auto *caseVal : cases)
+                if(caseVal and added.insert(caseVal).second)
+                    sw->addCase(caseVal, nextCandidate(0, caseVal));
+        }
+
+        for(size_t i = 0; i < numBranches; i++){
+            auto &mbn = n->branches[i];
+            BasicBlock *onFail = nextCandidate(i + 1, kind == SwitchKind::None ? nullptr : cases[i]);
 
+            c->builder.SetInsertPoint(patternBlocks[i]);
             c->enterNewScope();
-            handlePattern(*this, n, mbn->pattern.get(), endpat, valToMatch);
+
+            if(kind != SwitchKind::None and cases[i])
+                handleSwitchedPattern(*this, n, mbn->pattern.get(), onFail, valToMatch, kind);
+            else
+                handlePattern(*this, n, mbn->pattern.get(), onFail, valToMatch);
+
             mbn->branch->accept(*this);
             merges.push_back({c->builder.GetInsertBlock(), this->val});
+            c->exitScope();
 
             //dont jump to after the match if the branch already returned from the function
             if(!dyn_cast<ReturnInst>(this->val.val))
                 c->builder.CreateBr(endmatch);
-
-            c->builder.SetInsertPoint(endpat); //set insert point to next branch
-            finalEndPat = endpat == endmatch ? finalEndPat : endpat;
-            c->exitScope();
         }
 
         // Cannot prove to LLVM match is exhaustive so an uninitialized value must be
         // "returned" each time from the branch where all matches fail.
-        if(finalEndPat){
-            TypedValue retOnFailAll = {UndefValue::get(this->val.getType()), val.type};
-            merges.push_back({finalEndPat, retOnFailAll});
+        bool mayFail = !noMatch->use_empty();
+        if(mayFail){
+            c->builder.SetInsertPoint(noMatch);
+            c->builder.CreateBr(endmatch);
+            merges.push_back({noMatch, {UndefValue::get(this->val.getType()), val.type}});
+        }else{
+            noMatch->eraseFromParent();
         }
 
+        c->builder.SetInsertPoint(endmatch);
+
         //merges can be empty if each branch has an early return
         if(merges.empty() or merges[0].second.type->typeTag == TT_Void){
             this->val = c->getVoidLiteral();
@@ -266,7 +489,7 @@ namespace ante {
         }
 
         int i = 1;
-        auto *phi = c->builder.CreatePHI(merges[0].second.getType(), n->branches.size());
+        auto *phi = c->builder.CreatePHI(merges[0].second.getType(), merges.size());
         for(auto &pair : merges){
 
             //add each branch to the phi node if it does not return early
@@ -283,7 +506,6 @@ namespace ante {
             }
             i++;
         }
-        //phi->addIncoming(UndefValue::get(merges[0].second.getType()), matchbb);
         this->val = TypedValue(phi, merges[0].second.type);
     }
 }
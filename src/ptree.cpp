@@ -534,13 +534,15 @@ namespace ante {
             return ret;
         }
 
-        Node* mkDataDeclNode(LOC_TY loc, char* s, Node *p, Node* b, bool isAlias){
+        Node* mkDataDeclNode(LOC_TY loc, char* s, Node *p, Node* b, bool isAlias, Node *mods){
             vector<unique_ptr<TypeNode>> params;
             while(p){
                 params.emplace_back((TypeNode*)p);
                 p = p->next.release();
             }
-            return new DataDeclNode(loc, s, b, getTupleSize(b), params, isAlias);
+            auto *ret = new DataDeclNode(loc, s, b, getTupleSize(b), params, isAlias);
+            ret->modifiers.reset((ModNode*)mods);
+            return ret;
         }
 
 
@@ -1,5 +1,11 @@
 #include "repl.h"
 #include "target.h"
+#include "jit.h"
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringSet.h>
+#include <chrono>
+#include <iomanip>
+#include <list>
 #include <vector>
 #include <string>
 
@@ -10,6 +16,7 @@
 #endif
 
 using namespace std;
+using namespace llvm;
 using namespace ante;
 using namespace ante::parser;
 
@@ -394,21 +401,13 @@ namespace ante {
     }
 
     /**
-     * Output a value from the REPL by using its print function if found.
+     * Output a value from the REPL by calling its print function if found.
+     * The call is compiled into the current input's module and runs with it.
      */
     void output(Compiler *c, TypedValue &tv){
-        vector<AnType*> args = {tv.type};
-        string name = "print";
-
-        auto fake_loc = mkLoc(mkPos(0, 0, 0), mkPos(0, 0, 0));
-        Node *n = new VarNode(fake_loc, "print");
-        TypedValue tvf = searchForFunction(c, n, {tv});
-        string mangledName = tvf.val->getName();
-        delete n;
-
         try{
-            //compMetaFunctionResult(c, fake_loc, "print", mangledName, {tv});
-            compMetaFunctionResult(c, fake_loc, name, mangledName, {tv});
+            if(!c->callFn("print", {tv}))
+                tv.dump();
         }catch(CompilationError *err){
             //fall back on naive dumping of llvm value
             cerr << err->msg << endl;
@@ -421,10 +420,367 @@ namespace ante {
     }
 
 
+    /** @brief A module compiled from one REPL input and added to the REPL's JIT */
+    struct ReplModule {
+        JIT::ModuleHandle handle;
+
+        /** @brief Functions compiled into this module.  They are recompiled
+         * on their next use if the module is removed */
+        vector<FuncDecl*> fns;
+
+        /** @brief Names of the symbols this module defines and uses from other modules */
+        StringSet<> defines;
+        StringSet<> uses;
+    };
+
+
+    /**
+     * @brief Runs each REPL input as its own small module in a JIT session
+     * kept for the whole REPL.
+     *
+     * Functions and globals from earlier inputs are referred to by name and
+     * resolved by the JIT rather than recompiled.  Variables declared at the
+     * top level of an input are moved into memory owned by the session so
+     * later inputs can refer to them after the input's function returns.
+     */
+    class ReplSession {
+        Compiler *c;
+        JIT jit;
+        list<ReplModule> modules;
+
+        /** @brief Functions compiled into the current input's module so far */
+        vector<FuncDecl*> lineFns;
+
+        /** @brief Functions declared by REPL inputs.  Only these may be redefined */
+        DenseSet<FuncDecl*> declared;
+
+        /** @brief Storage for each top-level variable */
+        vector<unique_ptr<char[]>> cells;
+        unsigned lineNo = 0;
+
+        /** @brief Sets up c->module to compile the next input into */
+        Function* beginModule(string const& name);
+
+        /** @brief Stores each variable declared in fn into a new cell and rebinds it to the cell */
+        void moveVariablesToCells(Function *fn);
+
+        /** @brief Adds c->module to the JIT and returns a pointer to its function fnName */
+        void* addModule(string const& fnName);
+
+        /** @brief Removes the module and every module using its definitions from the JIT */
+        void removeModule(list<ReplModule>::iterator it);
+
+        /** @brief Frees the current module after an error, forgetting anything compiled into it */
+        void discardModule(Function *fn);
+
+    public:
+        /** @brief Adds the module c has compiled so far, such as the prelude, and runs its main function */
+        ReplSession(Compiler *c);
+
+        /** @brief Compiles and runs rn, printing its result */
+        void run(RootNode *rn);
+
+        /** @brief Records fd as declared by the current input if c is compiling it */
+        void declare(Compiler *c, FuncDecl *fd);
+
+        /** @brief Records fd as compiled into the current input's module */
+        void compiled(Compiler *c, FuncDecl *fd);
+
+        /** @brief Removes fd and the module it is compiled in so it can be redefined.
+         * Returns false if fd was not declared by a REPL input. */
+        bool redefine(FuncDecl *fd);
+    };
+
+    ReplSession *activeRepl = nullptr;
+
+
+    /**
+     * Returns a declaration within m of gv, which is from another module.
+     * Returns gv itself if it is already within m.
+     */
+    Constant* localize(llvm::Module &m, Constant *cv){
+        if(auto *gv = dyn_cast<GlobalValue>(cv)){
+            if(gv->getParent() == &m) return gv;
+
+            if(auto *f = dyn_cast<Function>(gv)){
+                if(auto *local = m.getFunction(f->getName())) return local;
+                return Function::Create(f->getFunctionType(), GlobalValue::ExternalLinkage, f->getName(), &m);
+            }
+            if(auto *g = dyn_cast<GlobalVariable>(gv)){
+                if(auto *local = m.getGlobalVariable(g->getName(), true)) return local;
+                return new GlobalVariable(m, g->getValueType(), g->isConstant(),
+                        GlobalValue::ExternalLinkage, nullptr, g->getName());
+            }
+            return gv;
+        }
+
+        if(auto *ce = dyn_cast<ConstantExpr>(cv)){
+            vector<Constant*> ops;
+            bool changed = false;
+            for(auto &op : ce->operands()){
+                ops.push_back(localize(m, cast<Constant>(op)));
+                changed |= ops.back() != op;
+            }
+            return changed ? ce->getWithOperands(ops) : ce;
+        }
+        return cv;
+    }
+
+
+    /**
+     * Replaces each reference within m to a function or global of an earlier
+     * module with a declaration so the JIT resolves it by name.
+     */
+    void localizeReferences(llvm::Module &m){
+        for(auto &f : m){
+            for(auto &bb : f){
+                for(auto &i : bb){
+                    for(unsigned k = 0; k < i.getNumOperands(); k++){
+                        auto *cv = dyn_cast<Constant>(i.getOperand(k));
+                        if(!cv) continue;
+
+                        auto *local = localize(m, cv);
+                        if(local != cv) i.setOperand(k, local);
+                    }
+                }
+            }
+        }
+
+        for(auto &g : m.globals())
+            if(g.hasInitializer())
+                g.setInitializer(localize(m, g.getInitializer()));
+    }
+
+
+    /**
+     * Gives each local definition of m, eg. string literals, a name unique to
+     * the module and external linkage so later modules may refer to them.
+     */
+    void externalizeDefinitions(llvm::Module &m){
+        string suffix = "." + m.getModuleIdentifier();
+
+        auto externalize = [&](GlobalValue &gv){
+            if(gv.isDeclaration() or !gv.hasLocalLinkage()) return;
+            gv.setName(gv.getName() + suffix);
+            gv.setLinkage(GlobalValue::ExternalLinkage);
+        };
+
+        for(auto &f : m) externalize(f);
+        for(auto &g : m.globals()) externalize(g);
+    }
+
+
+    ReplSession::ReplSession(Compiler *c) : c(c), jit(), modules(), cells(){
+        //The prelude's top-level code in main is run once, as it would be in a program
+        Function *main = c->builder.GetInsertBlock()->getParent();
+        moveVariablesToCells(main);
+        if(!c->builder.GetInsertBlock()->getTerminator())
+            c->builder.CreateRet(c->builder.getInt32(0));
+
+        if(auto mainFn = (int(*)(int, char**))addModule(main->getName().str()))
+            mainFn(0, nullptr);
+    }
+
+
+    Function* ReplSession::beginModule(string const& name){
+        c->module.reset(new llvm::Module(name, *c->ctxt));
+        c->module->setTargetTriple(jit.getTargetMachine().getTargetTriple().str());
+        c->module->setDataLayout(jit.getTargetMachine().createDataLayout());
+
+        auto *fnTy = FunctionType::get(Type::getVoidTy(*c->ctxt), false);
+        Function *fn = Function::Create(fnTy, Function::ExternalLinkage, name, c->module.get());
+        c->builder.SetInsertPoint(BasicBlock::Create(*c->ctxt, "entry", fn));
+        return fn;
+    }
+
+
+    void ReplSession::moveVariablesToCells(Function *fn){
+        DataLayout dl = jit.getTargetMachine().createDataLayout();
+        auto *intPtrTy = c->builder.getIntNTy(dl.getPointerSizeInBits());
+
+        if(auto *term = c->builder.GetInsertBlock()->getTerminator())
+            c->builder.SetInsertPoint(term);
+
+        for(auto &entry : *c->varTable.back()){
+            Variable *var = entry.getValue().get();
+            auto *inst = dyn_cast_or_null<Instruction>(var->tval.val);
+            if(!inst or inst->getParent()->getParent() != fn) continue;
+
+            Type *ty = var->autoDeref ? inst->getType()->getPointerElementType() : inst->getType();
+            Value *val = var->autoDeref ? c->builder.CreateLoad(ty, inst) : inst;
+
+            cells.emplace_back(new char[dl.getTypeAllocSize(ty)]());
+            auto *addr = ConstantInt::get(intPtrTy, (uintptr_t)cells.back().get());
+            auto *cell = ConstantExpr::getIntToPtr(addr, ty->getPointerTo());
+
+            c->builder.CreateStore(val, cell);
+            var->tval.val = cell;
+            var->autoDeref = true;
+        }
+    }
+
+
+    void ReplSession::declare(Compiler *c, FuncDecl *fd){
+        if(c == this->c)
+            declared.insert(fd);
+    }
+
+
+    void ReplSession::compiled(Compiler *c, FuncDecl *fd){
+        auto *f = dyn_cast_or_null<Function>(fd->tv.val);
+        if(c == this->c and f and f->getParent() == c->module.get())
+            lineFns.push_back(fd);
+    }
+
+
+    void* ReplSession::addModule(string const& fnName){
+        auto &mod = *c->module;
+        localizeReferences(mod);
+        externalizeDefinitions(mod);
+
+        ReplModule rm;
+        rm.fns = move(lineFns);
+        lineFns.clear();
+        for(auto &f : mod)
+            (f.isDeclaration() ? rm.uses : rm.defines).insert(f.getName());
+        for(auto &g : mod.globals())
+            (g.isDeclaration() ? rm.uses : rm.defines).insert(g.getName());
+
+        c->builder.ClearInsertionPoint();
+        rm.handle = jit.addModule(move(c->module));
+        modules.push_back(move(rm));
+
+        return (void*)jit.getSymbolAddress(fnName);
+    }
+
+
+    void ReplSession::removeModule(list<ReplModule>::iterator it){
+        ReplModule removed = move(*it);
+        modules.erase(it);
+        jit.removeModule(removed.handle);
+
+        for(auto &fd : removed.fns)
+            fd->tv = TypedValue();
+
+        //Modules calling into the removed one must be recompiled as well
+        auto dep = modules.begin();
+        while(dep != modules.end()){
+            bool usesRemoved = false;
+            for(auto &sym : removed.defines)
+                usesRemoved |= dep->uses.count(sym.getKey()) > 0;
+
+            if(usesRemoved){
+                removeModule(dep);
+                dep = modules.begin();
+            }else{
+                ++dep;
+            }
+        }
+    }
+
+
+    void ReplSession::discardModule(Function *fn){
+        for(auto *fd : lineFns)
+            fd->tv = TypedValue();
+        lineFns.clear();
+
+        auto &vars = *c->varTable.back();
+        for(auto it = vars.begin(); it != vars.end();){
+            auto *inst = dyn_cast_or_null<Instruction>(it->getValue()->tval.val);
+            auto cur = it++;
+            if(inst and inst->getParent()->getParent() == fn)
+                vars.erase(cur);
+        }
+
+        c->builder.ClearInsertionPoint();
+        c->module.reset();
+    }
+
+
+    void ReplSession::run(RootNode *rn){
+        auto start = chrono::steady_clock::now();
+        string name = "repl" + to_string(++lineNo);
+        Function *fn = beginModule(name);
+
+        //Compile each expression and hold onto the last value
+        TypedValue val = c->ast ? mergeAndCompile(c, rn)
+                       : (c->ast.reset(rn), CompilingVisitor::compile(c, rn));
+
+        //print val if it's not an error
+        if(!c->errFlag and !!val and val.type->typeTag != TT_Void)
+            output(c, val);
+
+        if(c->errFlag){
+            discardModule(fn);
+            c->errFlag = false;
+            return;
+        }
+
+        moveVariablesToCells(fn);
+        if(!c->builder.GetInsertBlock()->getTerminator())
+            c->builder.CreateRetVoid();
+
+        if(auto line = (void(*)())addModule(name))
+            line();
+
+        if(c->remarks){
+            chrono::duration<double, milli> ms = chrono::steady_clock::now() - start;
+            cerr << "remark: repl line " << lineNo << ": " << fixed << setprecision(3)
+                 << ms.count() << " ms\n";
+        }
+    }
+
+
+    bool ReplSession::redefine(FuncDecl *fd){
+        if(!declared.erase(fd)) return false;
+
+        auto eraseFrom = [&](vector<shared_ptr<FuncDecl>> &fns){
+            fns.erase(remove_if(fns.begin(), fns.end(), [&](shared_ptr<FuncDecl> &f){
+                return f.get() == fd;
+            }), fns.end());
+        };
+
+        //find the module fd is compiled in before it is freed
+        auto it = modules.begin();
+        for(; it != modules.end(); ++it){
+            if(find(it->fns.begin(), it->fns.end(), fd) != it->fns.end())
+                break;
+        }
+
+        if(it != modules.end())
+            removeModule(it);
+
+        lineFns.erase(remove(lineFns.begin(), lineFns.end(), fd), lineFns.end());
+        eraseFrom(c->compUnit->getFnDecls(fd->getName()));
+        eraseFrom(c->mergedCompUnits->getFnDecls(fd->getName()));
+        return true;
+    }
+
+
+    void replDeclaration(Compiler *c, FuncDecl *fd){
+        if(activeRepl)
+            activeRepl->declare(c, fd);
+    }
+
+
+    void replCompiledFn(Compiler *c, FuncDecl *fd){
+        if(activeRepl)
+            activeRepl->compiled(c, fd);
+    }
+
+
+    bool replRedefinition(Compiler *c, FuncDecl *fd){
+        return activeRepl and activeRepl->redefine(fd);
+    }
+
+
     void startRepl(Compiler *c){
         cout << "Ante REPL v0.2.0\nType 'exit' to exit.\n";
         setupTerm();
 
+        ReplSession session{c};
+        activeRepl = &session;
+
         auto cmd = getInputColorized();
 
         while(cmd != "exit\n"){
@@ -440,21 +796,13 @@ namespace ante {
                 continue;
             }
 
-            if(flag == PE_OK){
-                RootNode *expr = parser::getRootNode();
-
-                //Compile each expression and hold onto the last value
-                TypedValue val = c->ast ? mergeAndCompile(c, expr)
-                               : (c->ast.reset(expr), CompilingVisitor::compile(c, expr));
-
-                //print val if it's not an error
-                if(!!val and val.type->typeTag != TT_Void)
-                    output(c, val);
-            }
+            if(flag == PE_OK)
+                session.run(parser::getRootNode());
 
             cmd = getInputColorized();
         }
 
+        activeRepl = nullptr;
         resetTerm();
     }
 
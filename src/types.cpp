@@ -1,4 +1,6 @@
 #include <types.h>
+#include "codegen.h"
+#include <numeric>
 using namespace std;
 using namespace llvm;
 using namespace ante::parser;
@@ -140,6 +142,9 @@ Result<size_t, string> AnType::getSizeInBits(Compiler *c, string *incompleteType
             return "Type " + anTypeToStr(this) + " has not been declared\n";
         }
 
+        if(typeTag == TT_TaggedUnion)
+            return getUnionLayout(c, dataTy, force).sizeInBits;
+
         for(auto *ext : dataTy->extTys){
             auto val = ext->getSizeInBits(c, incompleteType, force);
             if(!val) return val;
@@ -231,36 +236,341 @@ string toLlvmTypeName(const AnDataType *dt){
     return name == baseName + "<" ? baseName : name+">";
 }
 
-Type* updateLlvmTypeBinding(Compiler *c, AnDataType *dt, bool force){
+unsigned getUnionTagBits(size_t numTags){
+    if(numTags <= (1ul << 8))  return 8;
+    if(numTags <= (1ul << 16)) return 16;
+    return 32;
+}
+
+/**
+ * Returns true if every value of the given type is a non-null pointer.  Function
+ * values can only be made by referring to a function, unlike raw pointers
+ * which may be null, eg. from malloc or an int -> ptr cast.
+ */
+bool isNonNullPointer(AnType *t){
+    return t->typeTag == TT_Function;
+}
+
+/** Returns the data of a union variant, the second element of its (tag, data) tuple */
+AnType* getUnionVariantData(AnType *variant){
+    auto *tup = dyn_cast_or_null<AnAggregateType>(variant);
+    return tup and tup->extTys.size() == 2 ? tup->extTys[1] : AnType::getVoid();
+}
+
+UnionLayout getUnionLayout(Compiler *c, AnDataType *dt, bool force){
+    UnionLayout layout;
+    layout.kind = UnionLayout::Tagged;
+    layout.tagBits = getUnionTagBits(dt->extTys.size());
+    layout.nicheTag = 0;
+
+    size_t numWithData = 0;
+    size_t dataTag = 0;
+    for(size_t i = 0; i < dt->extTys.size(); i++){
+        if(getUnionVariantData(dt->extTys[i])->typeTag != TT_Void){
+            numWithData++;
+            dataTag = i;
+        }
+    }
+
+    if(numWithData == 0){
+        layout.kind = UnionLayout::Enum;
+        layout.sizeInBits = layout.tagBits;
+    //Generic unions and their bindings always keep the tagged layout so a value
+    //made while a type variable is unbound has the same representation once bound
+    }else if(numWithData == 1 and dt->extTys.size() == 2 and !dt->isGeneric and !dt->unboundType
+            and isNonNullPointer(getUnionVariantData(dt->extTys[dataTag]))){
+        layout.kind = UnionLayout::NullNiche;
+        layout.nicheTag = 1 - dataTag;
+        layout.sizeInBits = AN_USZ_SIZE;
+    }else{
+        auto *largest = getLargestExt(c, dt, force);
+        auto size = getUnionVariantData(largest)->getSizeInBits(c, nullptr, force);
+        layout.sizeInBits = layout.tagBits + (size ? size.getVal() : 0);
+    }
+    return layout;
+}
+
+
+/**
+ * Prints the layout of the given union along with the number of bytes
+ * saved compared to the naive (u8 tag, largest variant) layout.
+ */
+void dumpUnionLayout(Compiler *c, AnDataType *dt, UnionLayout const& layout){
+    size_t largestData = 0;
+    for(auto *ext : dt->extTys){
+        auto size = getUnionVariantData(ext)->getSizeInBits(c, nullptr, true);
+        if(size and size.getVal() > largestData)
+            largestData = size.getVal();
+    }
+
+    size_t naiveBytes = (8 + largestData + 7) / 8;
+    size_t bytes = (layout.sizeInBits + 7) / 8;
+
+    cout << anTypeToColoredStr(dt) << ": " << bytes << " bytes, ";
+    if(layout.kind == UnionLayout::Enum)
+        cout << "u" << layout.tagBits << " tag only";
+    else if(layout.kind == UnionLayout::NullNiche)
+        cout << "pointer with " << dt->tags[layout.nicheTag]->name << " in its null niche";
+    else
+        cout << "u" << layout.tagBits << " tag + largest variant";
+
+    //Point out why a union like Maybe i32* does not use the niche of its pointer
+    if(layout.kind == UnionLayout::Tagged and dt->extTys.size() == 2){
+        auto *first = getUnionVariantData(dt->extTys[0]);
+        auto *second = getUnionVariantData(dt->extTys[1]);
+        if((first->typeTag == TT_Ptr and second->typeTag == TT_Void)
+                or (first->typeTag == TT_Void and second->typeTag == TT_Ptr))
+            cout << ", tag kept since the pointer may be null";
+    }
+
+    cout << " (saved " << (naiveBytes - bytes) << " of " << naiveBytes << " bytes)\n";
+}
+
+
+/**
+ * Translates a tagged union to the llvm type of its layout.  Data-less
+ * unions are just their tag, and null niche unions are an opaque pointer
+ * that is cast to the variant's type when matched.
+ */
+Type* updateUnionLlvmTypeBinding(Compiler *c, AnDataType *dt, bool force){
+    auto layout = getUnionLayout(c, dt, force);
+
+    if(c->dumpLayouts and !dt->llvmType and !dt->isGeneric)
+        dumpUnionLayout(c, dt, layout);
+
+    if(layout.kind == UnionLayout::Enum){
+        dt->llvmType = Type::getIntNTy(*c->ctxt, layout.tagBits);
+        return dt->llvmType;
+    }else if(layout.kind == UnionLayout::NullNiche){
+        dt->llvmType = Type::getInt8PtrTy(*c->ctxt);
+        return dt->llvmType;
+    }
+
     //create an empty type first so we dont end up with infinite recursion
-    bool isPacked = dt->typeTag == TT_TaggedUnion;
-    auto* structTy = dt->llvmType ? (StructType*)dt->llvmType
-        : StructType::create(*c->ctxt, {}, toLlvmTypeName(dt), isPacked);
+    auto* structTy = dt->llvmType and dt->llvmType->isStructTy() ? (StructType*)dt->llvmType
+        : StructType::create(*c->ctxt, {}, toLlvmTypeName(dt), true);
 
     dt->llvmType = structTy;
 
+    vector<Type*> tys;
+    tys.push_back(Type::getIntNTy(*c->ctxt, layout.tagBits));
+
+    auto *data = c->anTypeToLlvmType(getUnionVariantData(getLargestExt(c, dt, force)), force);
+    if(!data->isVoidTy())
+        tys.push_back(data);
+
+    structTy->setBody(tys, true);
+    return structTy;
+}
+
+
+/** Alignments of the llvm types of data types declared with ![align N] or ![cache_aligned] */
+DenseMap<Type*, unsigned> explicitAlignments;
+
+unsigned getExplicitAlignment(Type *ty){
+    auto it = explicitAlignments.find(ty);
+    if(it != explicitAlignments.end())
+        return it->second;
+
+    if(auto *arr = dyn_cast<ArrayType>(ty))
+        return getExplicitAlignment(arr->getElementType());
+
+    //Tuples are literal structs, data types have their own entry if they contain an aligned field
+    unsigned align = 0;
+    if(auto *tup = dyn_cast<StructType>(ty))
+        if(tup->isLiteral())
+            for(auto *elem : tup->elements())
+                align = max(align, getExplicitAlignment(elem));
+    return align;
+}
+
+unsigned getAlignment(Type *ty){
+    unsigned natural = ty->isSized() ? CodegenCtxt::get().dl.getABITypeAlignment(ty) : 1;
+    return max(natural, getExplicitAlignment(ty));
+}
+
+void alignGlobal(GlobalVariable *gv){
+    if(unsigned align = getExplicitAlignment(gv->getValueType())){
+#if LLVM_VERSION_MAJOR >= 10
+        gv->setAlignment(MaybeAlign(align));
+#else
+        gv->setAlignment(align);
+#endif
+    }
+}
+
+
+/**
+ * Inserts padding before each field of an over-aligned type, eg. one declared
+ * ![cache_aligned], so that the field's offset is a multiple of its alignment.
+ * llvm only knows of the natural alignment of a struct so it cannot do this itself.
+ *
+ * Returns the llvm index of each of the given fields, or an empty vector if no
+ * padding was needed.  align is raised to the largest alignment of any field.
+ */
+vector<unsigned> padOverAlignedFields(LLVMContext &ctxt, vector<Type*> &tys, unsigned &align){
+    auto &dl = CodegenCtxt::get().dl;
+    vector<Type*> padded;
+    vector<unsigned> indices;
+    size_t offset = 0;
+
+    for(auto *ty : tys){
+        unsigned natural = dl.getABITypeAlignment(ty);
+        unsigned fieldAlign = getExplicitAlignment(ty);
+
+        //the padding itself has an alignment of 1 so it starts right after the previous field
+        if(fieldAlign > natural and offset % fieldAlign){
+            size_t pad = alignTo(offset, fieldAlign) - offset;
+            padded.push_back(ArrayType::get(Type::getInt8Ty(ctxt), pad));
+            offset += pad;
+        }
+        align = max(align, fieldAlign);
+
+        offset = alignTo(offset, natural);
+        indices.push_back(padded.size());
+        padded.push_back(ty);
+        offset += dl.getTypeAllocSize(ty);
+    }
+
+    if(padded.size() == tys.size())
+        return {};
+
+    tys = padded;
+    return indices;
+}
+
+
+bool allSized(vector<Type*> const& tys){
+    for(auto *ty : tys)
+        if(!ty->isSized())
+            return false;
+    return true;
+}
+
+
+/**
+ * Returns the index of each field after reordering them by decreasing alignment to
+ * minimize padding, or an empty vector if the declaration order is already as small.
+ */
+vector<unsigned> getPaddingMinimizingOrder(LLVMContext &ctxt, vector<Type*> const& tys){
+    auto &dl = CodegenCtxt::get().dl;
+
+    vector<unsigned> order(tys.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](unsigned l, unsigned r){
+        return dl.getABITypeAlignment(tys[l]) > dl.getABITypeAlignment(tys[r]);
+    });
+
+    vector<Type*> sorted;
+    for(auto i : order)
+        sorted.push_back(tys[i]);
+
+    if(dl.getTypeAllocSize(StructType::get(ctxt, sorted)) >= dl.getTypeAllocSize(StructType::get(ctxt, tys)))
+        return {};
+
+    vector<unsigned> indices(tys.size());
+    for(unsigned i = 0; i < order.size(); i++)
+        indices[order[i]] = i;
+    return indices;
+}
+
+
+/**
+ * Prints the size, alignment, and offset of each field of the given
+ * translated data type along with the bytes saved by reordering its fields.
+ */
+void dumpDataLayout(AnDataType *dt, StructType *structTy, size_t declOrderSize){
+    auto &dl = CodegenCtxt::get().dl;
+    auto *layout = dl.getStructLayout(structTy);
+    size_t size = dl.getTypeAllocSize(structTy);
+    unsigned align = max<unsigned>(getExplicitAlignment(structTy), dl.getABITypeAlignment(structTy));
+
+    cout << anTypeToColoredStr(dt) << ": " << size << " bytes, align " << align;
+    if(dt->isPacked)
+        cout << ", packed";
+
+    for(unsigned i = 0; i < dt->fields.size() and i < structTy->getNumElements(); i++)
+        cout << (i ? ", " : ": ") << dt->fields[i] << " @ " << layout->getElementOffset(dt->getLlvmFieldIndex(i));
+
+    if(declOrderSize > size)
+        cout << " (saved " << (declOrderSize - size) << " of " << declOrderSize << " bytes by reordering)";
+    cout << endl;
+}
+
+
+Type* updateLlvmTypeBinding(Compiler *c, AnDataType *dt, bool force){
     if(dt->isGeneric and !force){
         cerr << "Type " << anTypeToStr(dt) << " is generic and cannot be translated.\n";
         c->errFlag = true;
         //return nullptr;
     }
 
-    AnType *ext = dt;
     if(dt->typeTag == TT_TaggedUnion)
-        ext = getLargestExt(c, dt, force);
+        return updateUnionLlvmTypeBinding(c, dt, force);
+
+    bool firstTranslation = !dt->llvmType;
+
+    //create an empty type first so we dont end up with infinite recursion
+    auto* structTy = dt->llvmType ? (StructType*)dt->llvmType
+        : StructType::create(*c->ctxt, {}, toLlvmTypeName(dt));
+
+    dt->llvmType = structTy;
 
     vector<Type*> tys;
-    if(auto *aggty = dyn_cast<AnAggregateType>(ext)){
-        for(auto *e : aggty->extTys){
-            auto *llvmTy = c->anTypeToLlvmType(e, force);
-            if(!llvmTy->isVoidTy())
-                tys.push_back(llvmTy);
+    bool hasVoidField = false;
+    for(auto *e : dt->extTys){
+        auto *llvmTy = c->anTypeToLlvmType(e, force);
+        if(!llvmTy->isVoidTy())
+            tys.push_back(llvmTy);
+        else
+            hasVoidField = true;
+    }
+
+    //Reorder the fields of types not declared ![extern] to minimize padding.  Void fields
+    //are not translated, so their declaration index would not match their llvm index.
+    bool sized = allSized(tys);
+    dt->fieldIndices.clear();
+    if(sized and !dt->isPacked and !dt->keepFieldOrder and !dt->isGeneric and !hasVoidField)
+        dt->fieldIndices = getPaddingMinimizingOrder(*c->ctxt, tys);
+
+    size_t declOrderSize = sized ? CodegenCtxt::get().dl.getTypeAllocSize(StructType::get(*c->ctxt, tys, dt->isPacked)) : 0;
+
+    if(!dt->fieldIndices.empty()){
+        vector<Type*> reordered(tys.size());
+        for(unsigned i = 0; i < tys.size(); i++)
+            reordered[dt->fieldIndices[i]] = tys[i];
+        tys = reordered;
+    }
+
+    if(c->remarks and firstTranslation and !dt->fieldIndices.empty())
+        cerr << "remark: reordered the fields of " << anTypeToStr(dt) << " to reduce padding, "
+             << "declare it ![extern] if it must match the layout of a C struct\n";
+
+    unsigned align = dt->alignment;
+    if(sized and !dt->isPacked and !hasVoidField){
+        auto padIndices = padOverAlignedFields(*c->ctxt, tys, align);
+        if(!padIndices.empty()){
+            vector<unsigned> indices;
+            for(unsigned i = 0; i < padIndices.size(); i++)
+                indices.push_back(padIndices[dt->getLlvmFieldIndex(i)]);
+            dt->fieldIndices = indices;
         }
-    }else{
-        tys.push_back(c->anTypeToLlvmType(ext, force));
     }
 
-    structTy->setBody(tys, isPacked);
+    //Pad the type to a multiple of its alignment so each element of an array stays aligned
+    if(align and sized){
+        size_t size = CodegenCtxt::get().dl.getTypeAllocSize(StructType::get(*c->ctxt, tys, dt->isPacked));
+        if(size % align)
+            tys.push_back(ArrayType::get(Type::getInt8Ty(*c->ctxt), align - size % align));
+
+        explicitAlignments[structTy] = align;
+    }
+
+    structTy->setBody(tys, dt->isPacked);
+
+    if(c->dumpLayouts and firstTranslation and sized and !dt->isGeneric and !dt->isStub())
+        dumpDataLayout(dt, structTy, declOrderSize);
+
     return structTy;
 }
 
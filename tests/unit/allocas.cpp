@@ -0,0 +1,40 @@
+#include "unittest.h"
+#include <llvm/IR/Instructions.h>
+
+/**
+ * @brief Counts the allocas in f, optionally only those outside of its entry block
+ */
+size_t countAllocas(llvm::Function *f, bool outsideEntryOnly){
+    size_t count = 0;
+    for(auto &bb : *f){
+        if(outsideEntryOnly and &bb == &f->getEntryBlock())
+            continue;
+
+        for(auto &inst : bb)
+            if(llvm::isa<llvm::AllocaInst>(inst))
+                count++;
+    }
+    return count;
+}
+
+TEST_CASE("Allocas are only created in entry blocks", "[allocas]"){
+    Compiler c{"tests/integration/nestedloops.an"};
+    c.optLvl = 0;
+    c.compile();
+
+    for(auto &f : *c.module){
+        if(f.isDeclaration()) continue;
+        INFO("function " << f.getName().str());
+        REQUIRE(countAllocas(&f, true) == 0);
+    }
+}
+
+TEST_CASE("Loops with mut variables contain no allocas at -O1", "[allocas]"){
+    Compiler c{"tests/integration/nestedloops.an"};
+    c.optLvl = 1;
+    c.compile();
+
+    auto *main = c.module->getFunction("main");
+    REQUIRE(main);
+    REQUIRE(countAllocas(main, false) == 0);
+}
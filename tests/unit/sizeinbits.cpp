@@ -1,4 +1,5 @@
 #include "unittest.h"
+#include "types.h"
 
 auto c = new Compiler(nullptr);
 
@@ -124,3 +125,34 @@ TEST_CASE("Force size in bits of generic type", "[getSizeInBits]"){
     REQUIRE(tup->getSizeInBits(c, nullptr, true).getVal() == 32 + 8*sizeof(void*));
     REQUIRE(fn->getSizeInBits(c, nullptr, true).getVal() == 8*sizeof(void*));
 }
+
+TEST_CASE("Size in bits of tagged union type", "[getSizeInBits]"){
+    auto u8 = AnType::getU8();
+    auto voidTy = AnType::getVoid();
+    auto variant = [&](AnType *data){ return AnAggregateType::get(TT_Tuple, {u8, data}); };
+
+    //Data-less unions are just their tag
+    auto enumTy = AnDataType::create("SizeTestEnum", {variant(voidTy), variant(voidTy), variant(voidTy)}, true, {});
+
+    //A function and a data-less variant store the data-less variant as a null function pointer
+    auto maybeFn = AnDataType::create("SizeTestMaybeFn",
+            {variant(AnFunctionType::get(AnType::getI32(), {AnType::getI32()}, false)), variant(voidTy)}, true, {});
+
+    //Raw pointers may be null so they keep their tag
+    auto maybePtr = AnDataType::create("SizeTestMaybePtr",
+            {variant(AnPtrType::get(AnType::getI32())), variant(voidTy)}, true, {});
+
+    //Otherwise unions are a tag and their largest variant
+    auto maybeI64 = AnDataType::create("SizeTestMaybeI64", {variant(AnType::getI64()), variant(voidTy)}, true, {});
+    auto either = AnDataType::create("SizeTestEither", {variant(AnType::getI16()), variant(AnType::getF64())}, true, {});
+
+    REQUIRE(enumTy->getSizeInBits(c).getVal() == 8);
+    REQUIRE(maybeFn->getSizeInBits(c).getVal() == 8*sizeof(void*));
+    REQUIRE(maybePtr->getSizeInBits(c).getVal() == 8 + 8*sizeof(void*));
+    REQUIRE(maybeI64->getSizeInBits(c).getVal() == 8 + 64);
+    REQUIRE(either->getSizeInBits(c).getVal() == 8 + 64);
+
+    REQUIRE(getUnionTagBits(2) == 8);
+    REQUIRE(getUnionTagBits(256) == 8);
+    REQUIRE(getUnionTagBits(257) == 16);
+}